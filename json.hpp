@@ -5,6 +5,7 @@
 #include "rapidjson/stringbuffer.h"
 
 #include <map>
+#include <optional>
 #include <string>
 #include <vector>
 #include <codecvt>
@@ -44,6 +45,19 @@ std::wstring parseValue(Val<std::wstring> const& value)
     return myconv.from_bytes(tmp);
 }
 
+/**
+ * Parse json value as an optional value, absent when null or missing.
+ */
+template<typename T>
+std::optional<T> parseValue(Val<std::optional<T>> const& value)
+{
+    if (value.v.IsNull())
+    {
+        return std::nullopt;
+    }
+    return parseValue(Val<T>{value.v});
+}
+
 /**
  * Parse json value value as vector of elements.
  */
@@ -65,11 +79,14 @@ std::vector<T> parseValue(Val<std::vector<T>> const& value)
 template<typename T>
 T parseValue(Val<T> const& value)
 {
+    static rapidjson::Value const missing;
+
     T t;
     boost::hana::for_each(boost::hana::keys(t), [&](auto key) {
                 auto &member = boost::hana::at_key(t, key);
                 using ValueType = typename std::remove_reference<decltype(member)>::type;
-                member = parseValue(Val<ValueType>{value.v[boost::hana::to<char const*>(key)]});
+                auto const found = value.v.FindMember(boost::hana::to<char const*>(key));
+                member = parseValue(Val<ValueType>{found == value.v.MemberEnd() ? missing : found->value});
             });
 
     return t;
@@ -87,6 +104,24 @@ void packValue(int value, JsonWriter & writer)
     writer.Int(value);
 }
 
+template<typename T>
+bool isAbsent(T const&)
+{
+    return false;
+}
+
+template<typename T>
+bool isAbsent(std::optional<T> const& t)
+{
+    return !t;
+}
+
+template<typename T>
+void packValue(std::optional<T> const& t, JsonWriter & writer)
+{
+    packValue(*t, writer);
+}
+
 template<typename T>
 void packValue(std::vector<T> const& t, JsonWriter & writer)
 {
@@ -106,6 +141,10 @@ void packValue(T const& t, JsonWriter & writer)
 
     boost::hana::for_each(boost::hana::keys(t), [&](auto key) {
                 auto &member = boost::hana::at_key(t, key);
+                if (isAbsent(member))
+                {
+                    return;
+                }
 
                 char const * json_key = boost::hana::to<char const*>(key);
                 writer.Key(json_key);
@@ -1,5 +1,7 @@
 #include <algorithm>
+#include <cstdlib>
 #include <numeric>
+#include <optional>
 #include <chrono>
 #include <thread>
 #include <iostream>
@@ -21,6 +23,9 @@
 
 #include "json11.hpp"
 #include "json.hpp"
+#include "serial_server/span_trace.hpp"
+#include "serial_server/state_frame.hpp"
+#include "serial_server/subscription_client.hpp"
 
 struct input_event
 {
@@ -68,7 +73,9 @@ struct AutoSplit
     (std::string, default_api),
     (std::string, game_started_api),
     (std::string, game_started_key),
-    (std::vector<CustomApi>, custom_apis)
+    (std::vector<CustomApi>, custom_apis),
+    // serial_server's WebSocket port, port + 1 when absent, 0 to only poll.
+    (std::optional<int>, ws_port)
     );
 };
 
@@ -453,6 +460,9 @@ int main()
 {
     auto game = load_splits<Game>("sm_any_kpdr.json");
 
+    // SPLIT_TRACE=<file>: record spans, written with the server's when the window closes.
+    char const* const trace_file = std::getenv("SPLIT_TRACE");
+    SpanTracer::enable(trace_file != nullptr);
 
     using namespace std::chrono_literals;
 
@@ -556,12 +566,145 @@ int main()
 
     std::thread t([&](AutoSplit const& auto_split_cfg)
     {
+        SpanTracer::instance().name_thread("autosplit");
         httplib::Client cli(auto_split_cfg.address.c_str(), auto_split_cfg.port);
+
+        // Each poll is a trace, sent along to the server; it starts with the sleep before it.
+        auto trace_id = SpanTracer::new_id();
+        auto const get = [&cli, &trace_id](std::string const& api, httplib::Headers headers = {})
+        {
+            Span span("http.get");
+            headers.emplace(SpanTracer::header, SpanTracer::format_id(trace_id));
+            return cli.Get(api.c_str(), headers);
+        };
+
+        // The default API is asked for binary states, decoded with the
+        // server's /schema; that is fetched once and again only when a frame
+        // carries a different schema. Servers answering with JSON still work.
+        std::optional<StateSchema> schema;
+        auto const schema_api = [](std::string api)
+        {
+            auto const at = api.rfind("state");
+            return at == std::string::npos ? api : api.replace(at, 5, "schema");
+        }(auto_split_cfg.default_api);
+        auto const watch_set = [&](httplib::Response const& res, std::string const& key) -> std::optional<std::chrono::milliseconds>
+        {
+            if (res.get_header_value("Content-Type") != StateFrame::content_type)
+            {
+                std::string err;
+                auto jsn = json11::Json::parse(res.body, err);
+                return jsn[key].bool_value() ? std::optional(0ms) : std::nullopt;
+            }
+
+            auto const frame = StateFrame::decode(res.body);
+            if (!schema || schema->id != frame.schema)
+            {
+                auto schema_res = get(schema_api);
+                if (!schema_res || schema_res->status != 200)
+                {
+                    return std::nullopt;
+                }
+                schema = StateSchema::parse(schema_res->body);
+            }
+            auto const id = schema->find(key);
+            if (id && *id < frame.values.size() && frame.values[*id])
+            {
+                return std::chrono::milliseconds(frame.age_ms);
+            }
+            return std::nullopt;
+        };
+
+        auto const start_at = [&](std::chrono::system_clock::time_point at)
+        {
+            state = State::RUNNING;
+            start_clock = at;
+            run.start();
+        };
+        auto const split_at = [&](std::chrono::system_clock::time_point at)
+        {
+            auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(at - start_clock);
+            auto const e = elapsed.count();
+            Span span("split");
+            set_best_possible_time(run.bestPossibleTime(e));
+            state = run.split(e) ? State::FINISH
+                                 : State::RUNNING;
+        };
+
+        // Watches read from serial_server's /state are pushed over its
+        // WebSocket instead, stamped with when the server sampled them. So is
+        // the start, if game_started_api is that device's /game_started.
+        // Other APIs, and any time the socket is down, are polled as before.
+        auto const device_path = [](std::string const& api, std::string const& route) -> std::optional<std::string>
+        {
+            std::string const prefix = "/devices/";
+            if (api == route)
+            {
+                return std::string("/");
+            }
+            if (api.size() > prefix.size() + route.size() && api.compare(0, prefix.size(), prefix) == 0
+                && api.compare(api.size() - route.size(), route.size(), route) == 0
+                && api.find('/', prefix.size()) == api.size() - route.size())
+            {
+                return api.substr(0, api.size() - route.size());
+            }
+            return std::nullopt;
+        };
+        auto const ws_port = auto_split_cfg.ws_port.value_or(auto_split_cfg.port + 1);
+        auto const ws_path = device_path(auto_split_cfg.default_api, "/state");
+        bool const start_pushed = ws_path && auto_split_cfg.game_started_key == "started"
+                                  && device_path(auto_split_cfg.game_started_api, "/game_started") == ws_path;
+        std::optional<WatchSubscription> subscription;
+        if (ws_port && ws_path)
+        {
+            subscription.emplace(auto_split_cfg.address, ws_port, *ws_path);
+        }
+        auto subscribe_after = std::chrono::steady_clock::now();
+
         while(1)
         {
+            TraceIdScope trace { trace_id };
+
+            bool const idle = state == State::IDLE;
+            std::optional<std::string> watch;
+            if (idle && start_pushed)
+            {
+                watch = "start";
+            }
+            else if (state == State::RUNNING)
+            {
+                auto const& split_key = (*run.current_row)->split.key;
+                if (std::none_of(auto_split_cfg.custom_apis.begin(), auto_split_cfg.custom_apis.end(),
+                                 [&split_key](auto const& custom_api) { return split_key == custom_api.name; }))
+                {
+                    watch = split_key;
+                }
+            }
+
+            if (watch && subscription && std::chrono::steady_clock::now() >= subscribe_after)
+            {
+                try
+                {
+                    subscription->follow(*watch);
+                    Span span("subscription.wait");
+                    if (auto const age = subscription->wait(100ms))
+                    {
+                        auto const at = std::chrono::system_clock::now() - *age;
+                        idle ? start_at(at) : split_at(at);
+                    }
+                    trace_id = SpanTracer::new_id();
+                    continue;
+                }
+                catch (std::exception const& e)
+                {
+                    std::cout << e.what() << ", polling instead\n";
+                    subscription->close();
+                    subscribe_after = std::chrono::steady_clock::now() + 5s;
+                }
+            }
+
             if (state == State::IDLE)
             {
-                auto res = cli.Get(auto_split_cfg.game_started_api.c_str());
+                auto res = get(auto_split_cfg.game_started_api);
                 if (res && res->status == 200)
                 {
                     auto body = res->body;
@@ -570,9 +713,7 @@ int main()
 
                     if (jsn[auto_split_cfg.game_started_key].bool_value())
                     {
-                        state = State::RUNNING;
-                        start_clock = std::chrono::system_clock::now();
-                        run.start();
+                        start_at(std::chrono::system_clock::now());
                     }
                 }
             }
@@ -597,24 +738,27 @@ int main()
 
                 std::cout << api << " " << key << '\n';
 
-                auto res = cli.Get(api.c_str());
+                auto res = api == auto_split_cfg.default_api ? get(api, { { "Accept", StateFrame::content_type } })
+                                                             : get(api);
                 if (res && res->status == 200)
                 {
-                    auto body = res->body;
-                    std::string err;
-                    auto jsn = json11::Json::parse(body, err);
-                    if (jsn[key].bool_value())
+                    try
                     {
-                        auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start_clock);
-                        auto const e = elapsed.count();
-                        set_best_possible_time(run.bestPossibleTime(e));
-                        state = run.split(e) ? State::FINISH
-                                             : State::RUNNING;
-
+                        if (auto const age = watch_set(*res, key))
+                        {
+                            split_at(std::chrono::system_clock::now() - *age);
+                        }
+                    }
+                    catch (std::exception const& e)
+                    {
+                        std::cout << e.what() << '\n';
                     }
                 }
             }
 
+            trace_id = SpanTracer::new_id();
+            TraceIdScope next { trace_id };
+            Span sleep("autosplit.sleep");
             std::this_thread::sleep_for(100ms);
         }
     }, game.autosplit);
@@ -684,5 +828,19 @@ int main()
     fm.show();
     nana::exec();
 
+    if (trace_file)
+    {
+        httplib::Client cli(game.autosplit.address.c_str(), game.autosplit.port);
+        auto const res = cli.Get("/trace");
+        std::string server_events = "[]";
+        if (res && res->status == 200)
+        {
+            std::string err;
+            auto const jsn = json11::Json::parse(res->body, err);
+            server_events = jsn["traceEvents"].dump();
+        }
+        std::ofstream of(trace_file);
+        of << SpanTracer::instance().chrome_json(server_events);
+    }
 
 }
@@ -0,0 +1,459 @@
+#include "asio_serial_source.hpp"
+
+#include <array>
+#include <deque>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/ioctl.h>
+#include <termios.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/serial_port.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+
+#include "logger.hpp"
+#include "span_trace.hpp"
+#include "rtt_estimator.hpp"
+#include "super_metroid.hpp"
+#include "usba_framer.hpp"
+
+namespace asio = boost::asio;
+
+namespace
+{
+
+// One thread drives the I/O of every port.
+asio::io_context & serial_io()
+{
+    struct Reactor
+    {
+        asio::io_context io;
+        asio::executor_work_guard<asio::io_context::executor_type> work = asio::make_work_guard(io);
+        std::thread thread { [this]
+        {
+            SpanTracer::instance().name_thread("serial io");
+            io.run();
+        } };
+
+        ~Reactor()
+        {
+            io.stop();
+            thread.join();
+        }
+    };
+
+    static Reactor reactor;
+    return reactor.io;
+}
+
+}
+
+/**
+ * Port state, only touched from the I/O thread. Completion handlers keep
+ * the channel alive and compare generations, so handlers of a closed port
+ * find out and do nothing.
+ */
+class AsioSerialSource::Channel : public std::enable_shared_from_this<Channel>
+{
+public:
+    Channel(std::string port_name, DeadlineConfig deadlines)
+        : port_name { std::move(port_name) }
+        , rtt { deadlines }
+        , metrics { this->port_name }
+        , port { serial_io() }
+        , timer { serial_io() }
+        , quiet { serial_io() }
+    {}
+
+    std::future<RegionData> submit(std::vector<SramRegion> regions)
+    {
+        auto transaction = std::make_shared<Transaction>();
+        transaction->regions = std::move(regions);
+        transaction->trace_id = SpanTracer::current_id();
+        transaction->submitted = SpanTracer::now_us();
+        auto result = transaction->promise.get_future();
+        asio::post(serial_io(), [self = shared_from_this(), transaction] { self->start(transaction); });
+        return result;
+    }
+
+    void close()
+    {
+        asio::post(serial_io(), [self = shared_from_this()]
+        {
+            if (self->port.is_open())
+            {
+                self->fail("Port closed");
+            }
+        });
+    }
+
+private:
+    struct Transaction
+    {
+        std::vector<SramRegion> regions;
+        UsbaRequest request;
+        size_t exchange = 0;
+        int attempts = 0;
+        RegionData result;
+        bool vector = false;
+        std::chrono::steady_clock::time_point sent;
+        std::chrono::steady_clock::time_point deadline;
+        std::promise<RegionData> promise;
+
+        // Spans run across completion handlers, so they are recorded by hand.
+        uint64_t trace_id = 0;
+        int64_t submitted = 0;
+        int64_t written = 0;
+    };
+
+    static void record_span(char const* name, Transaction const& transaction, int64_t start_us)
+    {
+        if (SpanTracer::enabled())
+        {
+            SpanTracer::instance().record(name, transaction.trace_id, start_us, SpanTracer::now_us());
+        }
+    }
+
+    void start(std::shared_ptr<Transaction> const& transaction)
+    {
+        try
+        {
+            if (!port.is_open())
+            {
+                open();
+            }
+        }
+        catch (std::exception const& e)
+        {
+            transaction->promise.set_exception(std::make_exception_ptr(std::runtime_error("Serial: " + port_name + ": " + e.what())));
+            return;
+        }
+
+        transaction->request = create_read_request(transaction->regions, vector_reads);
+        transaction->result.resize(transaction->regions.size());
+        for (auto const& exchange : transaction->request.exchanges)
+        {
+            transaction->vector = transaction->vector || exchange.vector;
+        }
+        if (transaction->request.exchanges.empty())
+        {
+            transaction->promise.set_value(std::move(transaction->result));
+            return;
+        }
+
+        unsent.push_back(transaction);
+        write_next();
+    }
+
+    void open()
+    {
+        port.open(port_name);
+        port.set_option(asio::serial_port::baud_rate(9600));
+        port.set_option(asio::serial_port::character_size(8));
+        port.set_option(asio::serial_port::parity(asio::serial_port::parity::none));
+        port.set_option(asio::serial_port::stop_bits(asio::serial_port::stop_bits::one));
+        int const dtr = TIOCM_DTR;
+        ::ioctl(port.native_handle(), TIOCMBIS, &dtr);
+        ::tcflush(port.native_handle(), TCIOFLUSH);
+        LOG_INFO << "Serial: Opened " << port_name;
+        if (opened)
+        {
+            metrics.reconnects.add();
+            fresh = true;
+        }
+        opened = true;
+
+        receive();
+    }
+
+    void write_next()
+    {
+        if (writing || draining || unsent.empty())
+        {
+            return;
+        }
+
+        // In flight from here on: response bytes can be read before the
+        // write completion runs.
+        auto const transaction = unsent.front();
+        unsent.pop_front();
+        transaction->sent = std::chrono::steady_clock::now();
+        record_span("serial.queued", *transaction, transaction->submitted);
+        transaction->written = SpanTracer::now_us();
+        // The first exchanges on a reopened port already had their first
+        // attempt on the port that was dropped.
+        transaction->deadline = transaction->sent + rtt.deadline(transaction->attempts + (fresh ? 1 : 0));
+        in_flight.push_back(transaction);
+        if (in_flight.size() == 1)
+        {
+            arm_timer();
+        }
+
+        LOG_HEX_DUMP("Serial: Request", transaction->request.frames.data(), transaction->request.frames.size());
+        writing = true;
+        asio::async_write(port, asio::buffer(transaction->request.frames),
+                          [this, self = shared_from_this(), generation = generation, transaction](boost::system::error_code const& error, size_t)
+        {
+            if (generation != this->generation)
+            {
+                return;
+            }
+            writing = false;
+            if (error)
+            {
+                fail("Failed writing: " + error.message());
+                return;
+            }
+            record_span("serial.write", *transaction, transaction->written);
+            write_next();
+        });
+    }
+
+    void receive()
+    {
+        port.async_read_some(asio::buffer(chunk),
+                             [this, self = shared_from_this(), generation = generation](boost::system::error_code const& error, size_t size)
+        {
+            if (generation != this->generation)
+            {
+                return;
+            }
+            if (error)
+            {
+                fail("Failed reading: " + error.message());
+                return;
+            }
+
+            if (draining)
+            {
+                wait_quiet();
+            }
+            else if (!in_flight.empty())
+            {
+                LOG_HEX_DUMP("Serial: Received", chunk.data(), size);
+                try
+                {
+                    framer.append(chunk.data(), size);
+                    consume();
+                }
+                catch (std::exception const& e)
+                {
+                    retry(e.what());
+                }
+            }
+            if (generation == this->generation)
+            {
+                receive();
+            }
+        });
+    }
+
+    void consume()
+    {
+        while (!in_flight.empty())
+        {
+            auto & transaction = *in_flight.front();
+            auto const& exchange = transaction.request.exchanges[transaction.exchange];
+            auto const status = framer.take(exchange, transaction.regions, transaction.result);
+            if (status == UsbaFramer::Status::incomplete)
+            {
+                return;
+            }
+            if (status == UsbaFramer::Status::skipped)
+            {
+                LOG_WARNING << "Serial: " << port_name << ": Skipped corrupt or stale bytes";
+                metrics.framing_errors.add();
+                continue;
+            }
+
+            if (++transaction.exchange == transaction.request.exchanges.size())
+            {
+                vector_confirmed = vector_confirmed || transaction.vector;
+                auto const elapsed = std::chrono::steady_clock::now() - transaction.sent;
+                rtt.record(elapsed);
+                metrics.round_trip.observe(elapsed);
+                fresh = false;
+                record_span("serial.exchange", transaction, transaction.written);
+                transaction.promise.set_value(std::move(transaction.result));
+                in_flight.pop_front();
+                arm_timer();
+            }
+        }
+        // Bytes nobody asked for are left over from a failed exchange.
+        framer.clear();
+    }
+
+    void arm_timer()
+    {
+        if (in_flight.empty())
+        {
+            timer.cancel();
+            return;
+        }
+
+        timer.expires_at(in_flight.front()->deadline);
+        timer.async_wait([this, self = shared_from_this(), generation = generation](boost::system::error_code const& error)
+        {
+            if (error || generation != this->generation || in_flight.empty()
+                || std::chrono::steady_clock::now() < in_flight.front()->deadline)
+            {
+                return;
+            }
+
+            auto const& late = *in_flight.front();
+            rtt.timed_out(std::chrono::duration_cast<std::chrono::milliseconds>(late.deadline - late.sent));
+            metrics.timeouts.add();
+            retry("Timed out");
+        });
+    }
+
+    // Sends everything in flight again once the line is quiet. Only a
+    // request that fails on its retry as well closes the port.
+    void retry(std::string const& why)
+    {
+        if (in_flight.front()->attempts > 0)
+        {
+            if (in_flight.front()->vector && vector_reads && !vector_confirmed)
+            {
+                LOG_WARNING << "Serial: Vectored read failed twice on " << port_name << ", using GET frames";
+                vector_reads = false;
+            }
+            fail(why);
+            return;
+        }
+
+        LOG_WARNING << "Serial: " << port_name << ": " << why << ", retrying";
+        for (auto transaction = in_flight.rbegin(); transaction != in_flight.rend(); ++transaction)
+        {
+            ++(*transaction)->attempts;
+            (*transaction)->exchange = 0;
+            unsent.push_front(*transaction);
+        }
+        in_flight.clear();
+        timer.cancel();
+
+        draining = true;
+        framer.clear();
+        ::tcflush(port.native_handle(), TCIFLUSH);
+        wait_quiet();
+    }
+
+    // Drops whatever the device still sends for the aborted exchanges,
+    // until nothing arrived for a while.
+    void wait_quiet()
+    {
+        quiet.expires_after(std::chrono::milliseconds(20));
+        quiet.async_wait([this, self = shared_from_this(), generation = generation](boost::system::error_code const& error)
+        {
+            if (error || generation != this->generation)
+            {
+                return;
+            }
+            draining = false;
+            framer.clear();
+            write_next();
+        });
+    }
+
+    // Fails every pending request and closes the port, the byte stream can
+    // no longer be matched to requests.
+    void fail(std::string const& why)
+    {
+        LOG_ERROR << "Serial: " << port_name << ": " << why;
+        ++generation;
+        boost::system::error_code ignored;
+        port.close(ignored);
+        timer.cancel();
+        quiet.cancel();
+        writing = false;
+        draining = false;
+        framer.clear();
+
+        auto const error = std::make_exception_ptr(std::runtime_error("Serial: " + port_name + ": " + why));
+        for (auto const& transaction : in_flight)
+        {
+            transaction->promise.set_exception(error);
+        }
+        for (auto const& transaction : unsent)
+        {
+            transaction->promise.set_exception(error);
+        }
+        in_flight.clear();
+        unsent.clear();
+    }
+
+    std::string const port_name;
+    RttEstimator rtt;
+    SerialMetrics metrics;
+
+    asio::serial_port port;
+    asio::steady_timer timer;
+    asio::steady_timer quiet;
+    uint64_t generation = 0;
+
+    std::deque<std::shared_ptr<Transaction>> unsent;
+    std::deque<std::shared_ptr<Transaction>> in_flight;
+    UsbaFramer framer;
+    std::array<unsigned char, 4096> chunk;
+    bool writing = false;
+    bool draining = false;
+    bool vector_reads = true;
+    bool vector_confirmed = false;
+    bool opened = false;
+    bool fresh = false;
+};
+
+AsioSerialSource::AsioSerialSource(std::string port_name, DeadlineConfig deadlines)
+    : port_name { port_name }
+    , channel { std::make_shared<Channel>(std::move(port_name), deadlines) }
+{}
+
+AsioSerialSource::~AsioSerialSource()
+{
+    channel->close();
+}
+
+RegionData AsioSerialSource::read(std::vector<SramRegion> const& regions)
+{
+    return read_async(regions).get();
+}
+
+std::future<RegionData> AsioSerialSource::read_async(std::vector<SramRegion> regions)
+{
+    return channel->submit(std::move(regions));
+}
+
+std::string AsioSerialSource::describe() const
+{
+    return "asio:" + port_name;
+}
+
+std::unique_ptr<MemorySource> make_asio_serial_source(std::string const& target)
+{
+    auto const question = target.find('?');
+    auto const port = target.substr(0, question);
+
+    DeadlineConfig deadlines;
+    if (question != std::string::npos)
+    {
+        std::istringstream is(target.substr(question + 1));
+        std::string option;
+        while (std::getline(is, option, '&'))
+        {
+            auto const equals = option.find('=');
+            auto const key = option.substr(0, equals);
+            auto const value = equals == std::string::npos ? std::string() : option.substr(equals + 1);
+            if (!deadlines.set_option(key, value))
+            {
+                throw SourceConfigError("Unknown asio source option " + option);
+            }
+        }
+    }
+    deadlines.validate();
+
+    return std::make_unique<AsioSerialSource>(port, deadlines);
+}
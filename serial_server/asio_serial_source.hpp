@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "memory_source.hpp"
+#include "rtt_estimator.hpp"
+
+/**
+ * Memory source on a USB serial device driven by boost::asio instead of
+ * blocking libserialport calls.
+ *
+ * All ports share one I/O thread. Requests are written as soon as they are
+ * made, so several can be in flight on one port, and responses are cut out
+ * of the incoming byte stream by a UsbaFramer, in request order. Every
+ * request has its own deadline from the port's RttEstimator, counted from
+ * when its frames were written. At a timeout everything in flight is sent
+ * again once the line is quiet, with a doubled deadline; only a request
+ * that times out on its retry too closes the port, and the next request
+ * reopens it.
+ */
+class AsioSerialSource : public MemorySource
+{
+public:
+    AsioSerialSource(std::string port_name, DeadlineConfig deadlines);
+    ~AsioSerialSource();
+
+    RegionData read(std::vector<SramRegion> const& regions) override;
+    std::future<RegionData> read_async(std::vector<SramRegion> regions) override;
+    std::string describe() const override;
+
+private:
+    class Channel;
+
+    std::string const port_name;
+    std::shared_ptr<Channel> channel;
+};
+
+/**
+ * Parse "<port>[?floor=ms&timeout=ms&factor=x]" (without the scheme).
+ */
+std::unique_ptr<MemorySource> make_asio_serial_source(std::string const& target);
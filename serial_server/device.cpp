@@ -0,0 +1,164 @@
+#include "device.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "read_plan.hpp"
+#include "json11.hpp"
+
+ServerConfig load_config(std::string const& path)
+{
+    std::ifstream f(path);
+    if (!f)
+    {
+        throw std::runtime_error("Config: could not open " + path);
+    }
+    std::string const s((std::istreambuf_iterator<char>(f)),
+                         std::istreambuf_iterator<char>());
+
+    std::string err;
+    auto const jsn = json11::Json::parse(s, err);
+    if (!err.empty())
+    {
+        throw std::runtime_error("Config: " + path + ": " + err);
+    }
+
+    ServerConfig config;
+    if (jsn["listen"].is_string())
+    {
+        config.address = jsn["listen"].string_value();
+    }
+    if (jsn["port"].is_number())
+    {
+        config.port = jsn["port"].int_value();
+        config.ws_port = config.port + 1;
+    }
+    if (jsn["ws_port"].is_number())
+    {
+        config.ws_port = jsn["ws_port"].int_value();
+    }
+    if (jsn["log_level"].is_string())
+    {
+        config.log_level = parse_log_level(jsn["log_level"].string_value());
+    }
+    if (jsn["trace"].is_bool())
+    {
+        config.trace = jsn["trace"].bool_value();
+    }
+
+    for (auto const& entry : jsn["devices"].array_items())
+    {
+        DeviceConfig device;
+        device.name = entry["name"].string_value();
+        device.source = entry["source"].string_value();
+        if (device.name.empty() || device.source.empty())
+        {
+            throw std::runtime_error("Config: every device needs a name and a source");
+        }
+        for (auto const& other : config.devices)
+        {
+            if (other.name == device.name)
+            {
+                throw std::runtime_error("Config: duplicate device '" + device.name + "'");
+            }
+        }
+
+        if (entry["profile"].is_string())
+        {
+            device.profile = entry["profile"].string_value();
+        }
+        if (entry["period_ms"].is_number())
+        {
+            device.period = std::chrono::milliseconds(entry["period_ms"].int_value());
+            if (device.period.count() <= 0)
+            {
+                throw std::runtime_error("Config: period_ms of '" + device.name + "' must be positive");
+            }
+        }
+        if (entry["gap"].is_number())
+        {
+            device.gap_threshold = static_cast<uint32_t>(entry["gap"].int_value());
+        }
+        device.record = entry["record"].string_value();
+        config.devices.push_back(std::move(device));
+    }
+
+    if (config.devices.empty())
+    {
+        throw std::runtime_error("Config: " + path + " lists no devices");
+    }
+    return config;
+}
+
+namespace
+{
+
+// Source of a device whose profile or trace could not be loaded.
+class SetupFailure : public MemorySource
+{
+public:
+    SetupFailure(std::string uri, std::string error)
+        : uri { std::move(uri) }
+        , error { std::move(error) }
+    {}
+
+    RegionData read(std::vector<SramRegion> const&) override
+    {
+        throw SourceUnavailable(error);
+    }
+
+    std::string describe() const override
+    {
+        return uri;
+    }
+
+    std::string status() const override
+    {
+        return "unavailable";
+    }
+
+private:
+    std::string const uri;
+    std::string const error;
+};
+
+}
+
+struct Device::Parts
+{
+    GameProfile profile;
+    std::unique_ptr<MemorySource> source;
+    std::unique_ptr<TraceRecorder> recorder;
+
+    static Parts set_up(DeviceConfig const& config)
+    {
+        Parts parts;
+        parts.profile.name = config.profile;
+        try
+        {
+            parts.profile = load_profile(config.profile);
+            parts.recorder = config.record.empty() ? nullptr : std::make_unique<TraceRecorder>(config.record);
+            parts.source = open_memory_source(config.source);
+        }
+        catch (std::exception const& e)
+        {
+            LOG_ERROR << config.name << ": " << e.what();
+            parts.source = std::make_unique<SetupFailure>(config.source, e.what());
+        }
+        return parts;
+    }
+};
+
+Device::Device(DeviceConfig const& config)
+    : Device(config, Parts::set_up(config))
+{}
+
+Device::Device(DeviceConfig const& config, Parts parts)
+    : name { config.name }
+    , profile { std::move(parts.profile) }
+    , source { std::move(parts.source) }
+    , recorder { std::move(parts.recorder) }
+    , plan { plan_reads(profile.read_watches(), config.gap_threshold) }
+    , sampler { config.name, *source, profile, events, plan, config.period, recorder.get() }
+{}
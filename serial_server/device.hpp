@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "event_log.hpp"
+#include "game_profile.hpp"
+#include "logger.hpp"
+#include "memory_source.hpp"
+#include "sampler.hpp"
+#include "trace_file.hpp"
+
+struct DeviceConfig
+{
+    std::string name;
+    std::string source;
+    std::string profile = "super_metroid_profile.json";
+    std::chrono::milliseconds period { 50 };
+    uint32_t gap_threshold = 32;
+    std::string record;
+};
+
+struct ServerConfig
+{
+    std::string address = "192.168.1.10";
+    int port = 8080;
+    int ws_port = 8081;
+    LogLevel log_level = LogLevel::info;
+    bool trace = false;
+    std::vector<DeviceConfig> devices;
+};
+
+/**
+ * Read a server config:
+ *
+ *   {
+ *     "listen": "192.168.1.10", "port": 8080, "ws_port": 8081, "log_level": "info", "trace": false,
+ *     "devices": [
+ *       { "name": "left", "source": "/dev/ttyACM0", "profile": "super_metroid_profile.json",
+ *         "period_ms": 50, "gap": 32, "record": "left.trace" },
+ *       ...
+ *     ]
+ *   }
+ *
+ * Everything but the device names and sources is optional. The WebSocket
+ * port defaults to the HTTP port + 1, 0 turns it off.
+ */
+ServerConfig load_config(std::string const& path);
+
+/**
+ * One console: its memory source and profile, and the sampler thread that
+ * owns the source. Devices share nothing, a device whose source is slow or
+ * failing only delays its own snapshots.
+ *
+ * A device that cannot be set up is still created, so it is listed and
+ * reported as unavailable. A source that cannot be opened yet is retried
+ * from the sampler, see open_memory_source. A bad profile, trace file or
+ * source URI fails every sample until the server is restarted with a
+ * fixed config.
+ */
+struct Device
+{
+    explicit Device(DeviceConfig const& config);
+
+    Device(Device const&) = delete;
+    Device & operator=(Device const&) = delete;
+
+    std::string const name;
+    GameProfile const profile;
+    std::unique_ptr<MemorySource> const source;
+    std::unique_ptr<TraceRecorder> const recorder;
+    std::vector<SramRegion> const plan;
+    EventLog events;
+    Sampler sampler;
+
+private:
+    struct Parts;
+
+    Device(DeviceConfig const& config, Parts parts);
+};
+
+using Devices = std::vector<std::unique_ptr<Device>>;
@@ -0,0 +1,250 @@
+#include "device_session.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include "logger.hpp"
+
+namespace
+{
+
+constexpr std::chrono::milliseconds min_backoff { 250 };
+constexpr std::chrono::milliseconds max_backoff { 8000 };
+
+}
+
+DeviceSession::DeviceSession(std::string port_name, DeadlineConfig deadlines)
+    : port_name { std::move(port_name) }
+    , port { nullptr, close_port }
+    , present { ::access(this->port_name.c_str(), F_OK) == 0 }
+    , random { std::random_device {}() }
+    , rtt { deadlines }
+    , metrics { this->port_name }
+    , watcher { this->port_name, [this](bool plugged)
+        {
+            present = plugged;
+            replugged = replugged || plugged;
+        } }
+{}
+
+RegionData DeviceSession::read(std::vector<SramRegion> const& regions)
+{
+    return reads.run(regions, [this, &regions] { return read_device(regions); });
+}
+
+RegionData DeviceSession::read_device(Regions const& regions)
+{
+    return with_port([this, &regions](sp_port * serial_port)
+    {
+        auto const read = [this, &regions, serial_port](bool vector, int attempt)
+        {
+            auto const deadline = rtt.deadline(attempt);
+            auto const start = std::chrono::steady_clock::now();
+            try
+            {
+                auto result = read_sram_multi(serial_port, regions, vector, deadline, &metrics);
+                auto const elapsed = std::chrono::steady_clock::now() - start;
+                rtt.record(elapsed);
+                metrics.round_trip.observe(elapsed);
+                vector_confirmed = vector_confirmed || vector;
+                fresh = false;
+                return result;
+            }
+            catch (...)
+            {
+                if (std::chrono::steady_clock::now() - start >= deadline)
+                {
+                    rtt.timed_out(deadline);
+                }
+                throw;
+            }
+        };
+
+        // The first read on a reopened port already had its first attempt
+        // on the port that was dropped.
+        try
+        {
+            return read(vector_reads, fresh ? 1 : 0);
+        }
+        catch (std::exception const& e)
+        {
+            LOG_WARNING << "Serial: Read failed (" << e.what() << "), retrying";
+            drain(serial_port);
+        }
+
+        try
+        {
+            return read(vector_reads, 1);
+        }
+        catch (std::exception const& e)
+        {
+            if (!vector_reads || vector_confirmed)
+            {
+                // with_port drops the port, the next read reconnects.
+                throw;
+            }
+            LOG_WARNING << "Serial: Vectored read failed twice (" << e.what() << "), using GET frames";
+            vector_reads = false;
+            drain(serial_port);
+        }
+
+        return read(false, 1);
+    });
+}
+
+void DeviceSession::drain(sp_port * serial_port)
+{
+    // Let the device finish whatever it is still sending for the failed
+    // exchange, so the retry does not read it as its own response.
+    unsigned char discard[512];
+    sp_flush(serial_port, SP_BUF_INPUT);
+    while (sp_blocking_read_next(serial_port, discard, sizeof(discard), 20) > 0)
+    {
+    }
+}
+
+std::string DeviceSession::status() const
+{
+    if (!present)
+    {
+        return "unplugged";
+    }
+
+    switch (link.load())
+    {
+    case Link::open:
+        return "connected";
+    case Link::backoff:
+        return "reconnecting";
+    default:
+        return "disconnected";
+    }
+}
+
+std::string DeviceSession::describe() const
+{
+    return "serial:" + port_name;
+}
+
+std::string const& DeviceSession::name() const
+{
+    return port_name;
+}
+
+sp_port * DeviceSession::acquire()
+{
+    if (port && !healthy())
+    {
+        LOG_WARNING << "Serial: Link to " << port_name << " lost, reconnecting";
+        release();
+    }
+
+    if (port)
+    {
+        return port.get();
+    }
+
+    auto const now = std::chrono::steady_clock::now();
+    if (replugged.exchange(false))
+    {
+        next_attempt = now;
+    }
+
+    // The watcher cannot see everything, e.g. without inotify, so the node
+    // is checked directly whenever a retry is due.
+    if (!present && now >= next_attempt)
+    {
+        present = ::access(port_name.c_str(), F_OK) == 0;
+        if (!present)
+        {
+            next_attempt = now + min_backoff;
+        }
+    }
+    if (!present)
+    {
+        throw SourceUnavailable("Serial: " + port_name + " is unplugged");
+    }
+    if (now < next_attempt)
+    {
+        throw SourceUnavailable("Serial: " + port_name + " unavailable, waiting to reconnect");
+    }
+
+    try
+    {
+        port = open_port(port_name);
+    }
+    catch (std::exception const& e)
+    {
+        // Jittered, so several servers do not retry a hub in lockstep.
+        backoff = std::clamp(backoff * 2, min_backoff, max_backoff);
+        auto const wait = std::chrono::milliseconds(std::uniform_int_distribution<long>(backoff.count() / 2, backoff.count())(random));
+        next_attempt = now + wait;
+        link = Link::backoff;
+        throw SourceUnavailable("Serial: " + port_name + ": " + e.what() + ", retrying in " + std::to_string(wait.count()) + " ms");
+    }
+
+    backoff = std::chrono::milliseconds(0);
+    link = Link::open;
+    if (opened)
+    {
+        metrics.reconnects.add();
+        fresh = true;
+    }
+    opened = true;
+    return port.get();
+}
+
+void DeviceSession::release()
+{
+    port.reset();
+    if (link == Link::open)
+    {
+        link = Link::closed;
+    }
+}
+
+bool DeviceSession::healthy()
+{
+    auto const waiting = sp_input_waiting(port.get());
+    if (waiting < 0)
+    {
+        return false;
+    }
+
+    // Leftovers from an aborted transaction would be parsed as the next response header.
+    if (waiting > 0 && sp_flush(port.get(), SP_BUF_INPUT) != SP_OK)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+std::unique_ptr<MemorySource> make_device_session(std::string const& target)
+{
+    auto const question = target.find('?');
+    auto const port = target.substr(0, question);
+
+    DeadlineConfig deadlines;
+    if (question != std::string::npos)
+    {
+        std::istringstream is(target.substr(question + 1));
+        std::string option;
+        while (std::getline(is, option, '&'))
+        {
+            auto const equals = option.find('=');
+            auto const key = option.substr(0, equals);
+            auto const value = equals == std::string::npos ? std::string() : option.substr(equals + 1);
+            if (!deadlines.set_option(key, value))
+            {
+                throw SourceConfigError("Unknown serial source option " + option);
+            }
+        }
+    }
+    deadlines.validate();
+
+    return std::make_unique<DeviceSession>(port, deadlines);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "hotplug_watcher.hpp"
+#include "memory_source.hpp"
+#include "rtt_estimator.hpp"
+#include "single_flight.hpp"
+#include "span_trace.hpp"
+#include "super_metroid.hpp"
+
+/**
+ * Memory source backed by a USB serial device, shared by every route.
+ *
+ * The port is opened on first use and kept configured between requests.
+ * A transaction that still fails after a retry drops the connection and the
+ * next request reopens it. Failed opens are retried with jittered
+ * exponential backoff; in between, and while the device node is missing,
+ * reads fail at once with SourceUnavailable. A HotplugWatcher on the node
+ * cuts the backoff short when the device comes back.
+ */
+class DeviceSession : public MemorySource
+{
+public:
+    explicit DeviceSession(std::string port_name, DeadlineConfig deadlines = {});
+
+    template<typename F>
+    auto with_port(F && f)
+    {
+        auto const guard = [this]
+        {
+            Span span("serial.lock");
+            return std::unique_lock<std::mutex>(mutex);
+        }();
+        sp_port * serial_port = acquire();
+        try
+        {
+            return f(serial_port);
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+    }
+
+    /**
+     * Read all regions in a single exchange, under a deadline derived from
+     * recent round trips. A failed exchange is retried once on the open
+     * port with twice the deadline; the port is only reopened if the retry
+     * fails too. Falls back to pipelined GET frames for good if VGET fails
+     * twice in a row before it ever worked. Concurrent reads of the same
+     * regions share one exchange.
+     */
+    RegionData read(std::vector<SramRegion> const& regions) override;
+    std::string describe() const override;
+    std::string status() const override;
+
+    std::string const& name() const;
+
+private:
+    using Regions = std::vector<SramRegion>;
+
+    RegionData read_device(Regions const& regions);
+    void drain(sp_port * serial_port);
+    sp_port * acquire();
+    void release();
+    bool healthy();
+
+    enum class Link
+    {
+        closed,
+        open,
+        backoff
+    };
+
+    std::string port_name;
+    mutable std::mutex mutex;
+    SerialPort port;
+    std::atomic<Link> link { Link::closed };
+    std::atomic<bool> present;
+    std::atomic<bool> replugged { false };
+    std::chrono::steady_clock::time_point next_attempt;
+    std::chrono::milliseconds backoff { 0 };
+    std::mt19937 random;
+    bool vector_reads = true;
+    bool vector_confirmed = false;
+    bool opened = false;
+    bool fresh = false;
+    RttEstimator rtt;
+    SerialMetrics metrics;
+    SingleFlight<Regions, RegionData> reads;
+
+    // Last, its callback uses the members above.
+    HotplugWatcher watcher;
+};
+
+/**
+ * Parse "<port>[?floor=ms&timeout=ms&factor=x]" (without the scheme).
+ */
+std::unique_ptr<MemorySource> make_device_session(std::string const& target);
@@ -0,0 +1,52 @@
+#include "event_log.hpp"
+
+#include <algorithm>
+
+EventLog::EventLog(size_t capacity)
+    : capacity { capacity }
+{}
+
+void EventLog::record(std::chrono::steady_clock::time_point timestamp, size_t watch, bool value)
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        events.push_back(WatchEvent { next_sequence++, timestamp, watch, value });
+        if (events.size() > capacity)
+        {
+            events.pop_front();
+        }
+    }
+    appended.notify_all();
+}
+
+std::vector<WatchEvent> EventLog::since(uint64_t sequence, bool * missed) const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return collect(sequence, missed);
+}
+
+std::vector<WatchEvent> EventLog::wait_since(uint64_t sequence, std::chrono::milliseconds timeout, bool * missed) const
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    // A cursor past the newest event will not catch up, report it at once.
+    appended.wait_for(lock, timeout, [this, sequence] { return next_sequence - 1 != sequence; });
+    return collect(sequence, missed);
+}
+
+uint64_t EventLog::last_sequence() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return next_sequence - 1;
+}
+
+std::vector<WatchEvent> EventLog::collect(uint64_t sequence, bool * missed) const
+{
+    if (missed)
+    {
+        *missed = sequence > 0 && (sequence >= next_sequence || (!events.empty() && events.front().sequence > sequence + 1));
+    }
+
+    auto const first = std::upper_bound(events.begin(), events.end(), sequence,
+            [](uint64_t sequence, WatchEvent const& event) { return sequence < event.sequence; });
+    return std::vector<WatchEvent>(first, events.end());
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/**
+ * A watch changing value, stamped with the time of the sample that saw it.
+ */
+struct WatchEvent
+{
+    uint64_t sequence;
+    std::chrono::steady_clock::time_point timestamp;
+    size_t watch;
+    bool value;
+};
+
+/**
+ * Ordered, bounded log of watch transitions. Sequence numbers start at 1
+ * and never repeat; the oldest events are dropped once capacity is reached.
+ */
+class EventLog
+{
+public:
+    explicit EventLog(size_t capacity = 4096);
+
+    void record(std::chrono::steady_clock::time_point timestamp, size_t watch, bool value);
+
+    /**
+     * Events with a sequence number greater than sequence, oldest first.
+     * missed, if given, is set when events after sequence were already
+     * dropped, or sequence is newer than any event (a cursor from before a
+     * restart); the client has to resync. A sequence of 0 never misses.
+     */
+    std::vector<WatchEvent> since(uint64_t sequence, bool * missed = nullptr) const;
+
+    /**
+     * Like since, but blocks for up to timeout while there is nothing newer.
+     */
+    std::vector<WatchEvent> wait_since(uint64_t sequence, std::chrono::milliseconds timeout, bool * missed = nullptr) const;
+
+    /**
+     * Sequence number of the newest event, 0 before the first.
+     */
+    uint64_t last_sequence() const;
+
+private:
+    std::vector<WatchEvent> collect(uint64_t sequence, bool * missed) const;
+
+    size_t const capacity;
+    mutable std::mutex mutex;
+    mutable std::condition_variable appended;
+    std::deque<WatchEvent> events;
+    uint64_t next_sequence = 1;
+};
@@ -0,0 +1,69 @@
+// Stand-in for an emulator process: holds a 128 KiB WRAM array behind a
+// signature so the pid: memory source can find and read it.
+//
+//   fake_wram [--script file]
+//
+// The script format is described in memory_script.hpp, addresses are in
+// the usb2snes space (WRAM at 0xf50000).
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "memory_script.hpp"
+
+namespace
+{
+
+constexpr unsigned char signature[16] = {
+    'P', 'L', 'U', 'T', 'O', '-', 'F', 'A', 'K', 'E', '-', 'W', 'R', 'A', 'M', '!'
+};
+
+struct Memory
+{
+    unsigned char signature[16];
+    unsigned char wram[0x20000];
+};
+
+}
+
+int main(int argc, char * argv[])
+{
+    auto memory = std::make_unique<Memory>();
+    std::memcpy(memory->signature, signature, sizeof(signature));
+    std::memset(memory->wram, 0, sizeof(memory->wram));
+
+    std::cout << "pid " << getpid() << ", WRAM at 0x" << std::hex << reinterpret_cast<uintptr_t>(memory->wram) << '\n';
+    std::cout << "Source: pid:" << std::dec << getpid() << "?signature=";
+    for (auto const byte : signature)
+    {
+        std::cout << std::hex << std::setw(2) << std::setfill('0') << int(byte);
+    }
+    std::cout << "&offset=" << std::dec << sizeof(signature) << std::endl;
+
+    ScriptPlayer player(load_script(argc == 3 && std::string(argv[1]) == "--script" ? argv[2] : ""));
+    for (auto timeout = player.next_timeout_ms(); timeout >= 0; timeout = player.next_timeout_ms())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+        player.apply_due([&memory](uint32_t address, std::vector<unsigned char> const& bytes)
+        {
+            for (size_t i = 0; i < bytes.size() && address - 0xf50000 + i < sizeof(memory->wram); ++i)
+            {
+                memory->wram[address - 0xf50000 + i] = bytes[i];
+            }
+            std::cout << "Script: " << std::hex << address << std::dec << std::endl;
+        });
+    }
+
+    while (true)
+    {
+        std::this_thread::sleep_for(std::chrono::hours(1));
+    }
+}
@@ -0,0 +1,218 @@
+#include "game_profile.hpp"
+
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <stdexcept>
+
+#include "json11.hpp"
+#include "state_frame.hpp"
+
+namespace
+{
+
+// A 32-bit unsigned number, as a JSON number or a string such as "0x7e09a4".
+uint32_t parse_number(json11::Json const& value, std::string const& key, char const* field, std::optional<uint32_t> fallback)
+{
+    auto const invalid = [&key, field](char const* why)
+    {
+        return std::runtime_error("Profile: " + std::string(field) + " of " + key + " " + why);
+    };
+
+    if (value.is_null())
+    {
+        if (!fallback)
+        {
+            throw invalid("is missing");
+        }
+        return *fallback;
+    }
+    if (value.is_number())
+    {
+        auto const number = value.number_value();
+        if (!(number >= 0 && number <= 0xffffffff) || std::floor(number) != number)
+        {
+            throw invalid("must be a whole number from 0 to 0xffffffff");
+        }
+        return static_cast<uint32_t>(number);
+    }
+    if (value.is_string())
+    {
+        auto const& text = value.string_value();
+        size_t end = 0;
+        unsigned long long number = 0;
+        try
+        {
+            number = text.empty() || text[0] == '-' ? 0 : std::stoull(text, &end, 0);
+        }
+        catch (std::exception const&)
+        {
+            end = 0;
+        }
+        if (end == 0 || end != text.size() || number > 0xffffffff)
+        {
+            throw invalid("must be a whole number from 0 to 0xffffffff");
+        }
+        return static_cast<uint32_t>(number);
+    }
+
+    throw invalid("must be a number");
+}
+
+Comparison parse_comparison(std::string const& compare)
+{
+    static std::map<std::string, Comparison> const comparisons
+    {
+         {""   , Comparison::any}
+        ,{"any", Comparison::any}
+        ,{"all", Comparison::all}
+        ,{"eq" , Comparison::equal}
+        ,{"ne" , Comparison::not_equal}
+    };
+
+    auto const it = comparisons.find(compare);
+    if (it == comparisons.end())
+    {
+        throw std::runtime_error("Profile: unknown comparison " + compare);
+    }
+    return it->second;
+}
+
+}
+
+std::optional<size_t> GameProfile::find(std::string const& key) const
+{
+    for (size_t id = 0; id < keys.size(); ++id)
+    {
+        if (keys[id] == key)
+        {
+            return id;
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<Watch> GameProfile::read_watches() const
+{
+    std::vector<Watch> bytes;
+    for (auto const& watch : watches)
+    {
+        for (uint8_t i = 0; i < watch.width; ++i)
+        {
+            auto const mask = static_cast<unsigned char>(watch.mask >> (8 * i));
+            if (mask)
+            {
+                bytes.push_back(Watch { watch.address + i, mask });
+            }
+        }
+    }
+    return bytes;
+}
+
+bool GameProfile::evaluate(size_t id, SramData const& sram) const
+{
+    auto const& watch = watches[id];
+
+    uint32_t value {};
+    for (uint8_t i = 0; i < watch.width; ++i)
+    {
+        value |= static_cast<uint32_t>(sram.byte_at(watch.address + i)) << (8 * i);
+    }
+    value &= watch.mask;
+
+    switch (watch.comparison)
+    {
+        case Comparison::any:       return value != 0;
+        case Comparison::all:       return value == watch.mask;
+        case Comparison::equal:     return value == watch.expected;
+        case Comparison::not_equal: return value != watch.expected;
+    }
+    return false;
+}
+
+WatchState GameProfile::evaluate(SramData const& sram) const
+{
+    WatchState state;
+    for (size_t id = 0; id < watches.size(); ++id)
+    {
+        state[id] = evaluate(id, sram);
+    }
+    return state;
+}
+
+GameProfile load_profile(std::string const& path)
+{
+    std::ifstream f(path);
+    if (!f)
+    {
+        throw std::runtime_error("Profile: could not open " + path);
+    }
+    std::string const s((std::istreambuf_iterator<char>(f)),
+                         std::istreambuf_iterator<char>());
+
+    std::string err;
+    auto const jsn = json11::Json::parse(s, err);
+    if (!err.empty())
+    {
+        throw std::runtime_error("Profile: " + path + ": " + err);
+    }
+
+    GameProfile profile;
+    profile.name = jsn["name"].string_value();
+
+    for (auto const& entry : jsn["watches"].array_items())
+    {
+        auto const& key = entry["key"].string_value();
+        if (key.empty() || profile.find(key))
+        {
+            throw std::runtime_error("Profile: missing or duplicate key '" + key + "'");
+        }
+        if (profile.watches.size() == max_watches)
+        {
+            throw std::runtime_error("Profile: more than " + std::to_string(max_watches) + " watches");
+        }
+
+        auto const width = parse_number(entry["width"], key, "width", 1);
+        if (width < 1 || width > 4)
+        {
+            throw std::runtime_error("Profile: width of " + key + " must be 1-4 bytes");
+        }
+        auto const full_mask = width == 4 ? 0xffffffffu : (1u << (8 * width)) - 1;
+
+        CompiledWatch watch {};
+        watch.address = parse_number(entry["address"], key, "address", std::nullopt);
+        watch.width = static_cast<uint8_t>(width);
+        watch.mask = parse_number(entry["mask"], key, "mask", full_mask) & full_mask;
+        watch.expected = parse_number(entry["value"], key, "value", 0) & watch.mask;
+        watch.comparison = parse_comparison(entry["compare"].string_value());
+
+        profile.watches.push_back(watch);
+        profile.keys.push_back(key);
+        profile.json_keys.push_back(json11::Json(key).dump() + ':');
+        profile.names.push_back(entry["name"].is_string() ? entry["name"].string_value() : key);
+    }
+
+    auto const find_named = [&profile, &jsn](char const* what)
+    {
+        auto const key = jsn[what].string_value();
+        auto const id = profile.find(key);
+        if (!id)
+        {
+            throw std::runtime_error(std::string("Profile: unknown ") + what + " watch '" + key + "'");
+        }
+        return id;
+    };
+    if (jsn["start"].is_string())
+    {
+        profile.start_watch = find_named("start");
+    }
+    if (jsn["end"].is_string())
+    {
+        profile.end_watch = find_named("end");
+    }
+    profile.schema = schema_hash(profile.keys);
+
+    return profile;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "read_plan.hpp"
+
+enum class Comparison : uint8_t
+{
+    any,        // (value & mask) != 0
+    all,        // (value & mask) == mask
+    equal,      // (value & mask) == expected
+    not_equal   // (value & mask) != expected
+};
+
+inline constexpr size_t max_watches = 256;
+
+/**
+ * Result of evaluating every watch of a profile, indexed by watch id.
+ */
+using WatchState = std::bitset<max_watches>;
+
+/**
+ * Hot part of a watch definition, everything needed to evaluate it.
+ * width bytes are read little endian starting at address.
+ */
+struct CompiledWatch
+{
+    uint32_t address;
+    uint32_t mask;
+    uint32_t expected;
+    uint8_t width;
+    Comparison comparison;
+};
+
+/**
+ * Watch definitions for one game, loaded from a profile file. A watch is
+ * identified by its index; keys and names are kept apart from the compiled
+ * table so evaluation only touches the flat array.
+ */
+struct GameProfile
+{
+    std::string name;
+    std::vector<CompiledWatch> watches;
+    std::vector<std::string> keys;
+    std::vector<std::string> names;
+    // Each key rendered once as a JSON member prefix: "key":
+    std::vector<std::string> json_keys;
+
+    std::optional<size_t> start_watch;
+    std::optional<size_t> end_watch;
+    // schema_hash of keys, sent with binary states.
+    uint32_t schema = 0;
+
+    std::optional<size_t> find(std::string const& key) const;
+
+    /**
+     * Watched bytes, as input for plan_reads.
+     */
+    std::vector<Watch> read_watches() const;
+
+    bool evaluate(size_t id, SramData const& sram) const;
+    WatchState evaluate(SramData const& sram) const;
+};
+
+/**
+ * Load a profile. Throws std::runtime_error when the file is missing or malformed.
+ */
+GameProfile load_profile(std::string const& path);
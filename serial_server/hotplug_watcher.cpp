@@ -0,0 +1,144 @@
+#include "hotplug_watcher.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+namespace
+{
+
+constexpr uint32_t watch_mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF;
+
+}
+
+HotplugWatcher::HotplugWatcher(std::string const& path, Callback callback)
+    : callback { std::move(callback) }
+{
+    auto const slash = path.rfind('/');
+    directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    file = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    inotify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify < 0)
+    {
+        LOG_WARNING << "Hotplug: Cannot watch " << directory << ": " << std::strerror(errno);
+        return;
+    }
+    arm();
+
+    wake = ::eventfd(0, EFD_CLOEXEC);
+    thread = std::thread([this] { run(); });
+}
+
+HotplugWatcher::~HotplugWatcher()
+{
+    if (thread.joinable())
+    {
+        uint64_t const one = 1;
+        ::write(wake, &one, sizeof(one));
+        thread.join();
+    }
+    if (wake >= 0)
+    {
+        ::close(wake);
+    }
+    if (inotify >= 0)
+    {
+        ::close(inotify);
+    }
+}
+
+// Watches directory, or its nearest existing ancestor while it is missing.
+void HotplugWatcher::arm()
+{
+    if (watch >= 0)
+    {
+        ::inotify_rm_watch(inotify, watch);
+        watch = -1;
+    }
+
+    auto candidate = directory;
+    while (true)
+    {
+        watch = ::inotify_add_watch(inotify, candidate.c_str(), watch_mask);
+        auto const slash = candidate.rfind('/');
+        if (watch >= 0 || candidate == "/" || candidate == "." || slash == std::string::npos)
+        {
+            break;
+        }
+        candidate = slash == 0 ? "/" : candidate.substr(0, slash);
+    }
+
+    if (watch < 0)
+    {
+        LOG_WARNING << "Hotplug: Cannot watch " << directory << ": " << std::strerror(errno);
+    }
+    else if (candidate != watched)
+    {
+        LOG_DEBUG << "Hotplug: Watching " << candidate << " for " << directory << '/' << file;
+    }
+    watched = watch >= 0 ? candidate : std::string();
+}
+
+void HotplugWatcher::run()
+{
+    alignas(inotify_event) char buffer[4096];
+    while (true)
+    {
+        pollfd fds[] = { { inotify, POLLIN, 0 }, { wake, POLLIN, 0 } };
+        if (::poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            return;
+        }
+        if (fds[1].revents)
+        {
+            return;
+        }
+
+        auto const length = ::read(inotify, buffer, sizeof(buffer));
+        for (ssize_t offset = 0; offset < length;)
+        {
+            auto const* event = reinterpret_cast<inotify_event const*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->wd != watch)
+            {
+                continue;
+            }
+
+            // The watched directory went away, or something appeared below
+            // the ancestor watched in its place: move the watch as deep as
+            // it goes, and report a node that came with the directory.
+            bool const gone = (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) != 0;
+            bool const closer = watched != directory && (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0;
+            if (gone || closer)
+            {
+                auto const before = watched;
+                arm();
+                if (watched == directory && before != directory && ::access((directory + '/' + file).c_str(), F_OK) == 0)
+                {
+                    LOG_INFO << "Hotplug: " << directory << '/' << file << " appeared";
+                    callback(true);
+                }
+                continue;
+            }
+
+            if (watched != directory || event->len == 0 || file != event->name)
+            {
+                continue;
+            }
+
+            // Attribute changes matter too: udev fixes permissions after the node appears.
+            auto const present = (event->mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB)) != 0;
+            LOG_INFO << "Hotplug: " << directory << '/' << file << (present ? " appeared" : " removed");
+            callback(present);
+        }
+    }
+}
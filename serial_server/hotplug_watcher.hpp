@@ -0,0 +1,40 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <thread>
+
+/**
+ * Watches the directory of a device node with inotify and reports when
+ * the node appears or disappears, e.g. when a USB cable is plugged in or
+ * pulled. The callback runs on the watcher's own thread.
+ *
+ * udev removes directories such as /dev/serial/by-id along with their last
+ * device; while the directory is missing the nearest existing ancestor is
+ * watched until it is back. Without inotify nothing is reported, owners
+ * check the node themselves whenever they would retry anyway.
+ */
+class HotplugWatcher
+{
+public:
+    using Callback = std::function<void(bool present)>;
+
+    HotplugWatcher(std::string const& path, Callback callback);
+    ~HotplugWatcher();
+
+    HotplugWatcher(HotplugWatcher const&) = delete;
+    HotplugWatcher & operator=(HotplugWatcher const&) = delete;
+
+private:
+    void run();
+    void arm();
+
+    std::string directory;
+    std::string file;
+    Callback const callback;
+    int inotify = -1;
+    int watch = -1;
+    std::string watched;
+    int wake = -1;
+    std::thread thread;
+};
@@ -0,0 +1,234 @@
+#include "logger.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <ctime>
+#include <stdexcept>
+
+namespace
+{
+
+char const* level_name(LogLevel level)
+{
+    switch (level)
+    {
+    case LogLevel::debug:
+        return "DEBUG";
+    case LogLevel::info:
+        return "INFO ";
+    case LogLevel::warning:
+        return "WARN ";
+    default:
+        return "ERROR";
+    }
+}
+
+}
+
+std::atomic<LogLevel> Logger::threshold { LogLevel::info };
+
+LogLevel parse_log_level(std::string const& name)
+{
+    if (name == "debug")
+    {
+        return LogLevel::debug;
+    }
+    if (name == "info")
+    {
+        return LogLevel::info;
+    }
+    if (name == "warning")
+    {
+        return LogLevel::warning;
+    }
+    if (name == "error")
+    {
+        return LogLevel::error;
+    }
+    throw std::runtime_error("Unknown log level " + name);
+}
+
+Logger & Logger::instance()
+{
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+{
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    thread = std::thread([this] { run(); });
+}
+
+Logger::~Logger()
+{
+    running = false;
+    thread.join();
+    flush();
+}
+
+void Logger::push(LogRecord const& record)
+{
+    auto position = tail.load(std::memory_order_relaxed);
+    while (true)
+    {
+        auto & slot = slots[position % capacity];
+        auto const sequence = slot.sequence.load(std::memory_order_acquire);
+        auto const difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+        if (difference == 0)
+        {
+            if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                slot.record = record;
+                slot.sequence.store(position + 1, std::memory_order_release);
+                return;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Full: the flusher is behind, losing a line beats blocking a request.
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            position = tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool Logger::pop(LogRecord & record)
+{
+    auto & slot = slots[head % capacity];
+    if (slot.sequence.load(std::memory_order_acquire) != head + 1)
+    {
+        return false;
+    }
+
+    record = slot.record;
+    slot.sequence.store(head + capacity, std::memory_order_release);
+    ++head;
+    return true;
+}
+
+void Logger::run()
+{
+    while (running.load(std::memory_order_relaxed))
+    {
+        flush();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+void Logger::flush()
+{
+    LogRecord record;
+    bool wrote = false;
+    while (pop(record))
+    {
+        auto const time = std::chrono::system_clock::to_time_t(record.time);
+        auto const ms = std::chrono::duration_cast<std::chrono::milliseconds>(record.time.time_since_epoch()).count() % 1000;
+        std::tm local {};
+        localtime_r(&time, &local);
+
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "%H:%M:%S", &local);
+        std::fprintf(stderr, "%s.%03d %s %.*s\n", stamp, static_cast<int>(ms), level_name(record.level), record.length, record.text);
+        wrote = true;
+    }
+
+    if (auto const lost = dropped.exchange(0, std::memory_order_relaxed))
+    {
+        std::fprintf(stderr, "Logger: dropped %llu lines\n", static_cast<unsigned long long>(lost));
+        wrote = true;
+    }
+    if (wrote)
+    {
+        std::fflush(stderr);
+    }
+}
+
+LogLine::LogLine(LogLevel level)
+{
+    record.level = level;
+    record.time = std::chrono::system_clock::now();
+    record.length = 0;
+}
+
+LogLine::~LogLine()
+{
+    Logger::instance().push(record);
+}
+
+LogLine & LogLine::operator<<(std::string_view text)
+{
+    auto const n = std::min(text.size(), LogRecord::max_length - record.length);
+    std::copy_n(text.data(), n, record.text + record.length);
+    record.length += static_cast<uint16_t>(n);
+    return *this;
+}
+
+LogLine & LogLine::operator<<(char c)
+{
+    return *this << std::string_view(&c, 1);
+}
+
+LogLine & LogLine::operator<<(LogHex hex)
+{
+    char buffer[20];
+    auto const result = std::to_chars(buffer, buffer + sizeof(buffer), hex.value, 16);
+    return *this << std::string_view(buffer, result.ptr - buffer);
+}
+
+void LogLine::append_number(long long value)
+{
+    char buffer[24];
+    auto const result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    *this << std::string_view(buffer, result.ptr - buffer);
+}
+
+void LogLine::append_number(unsigned long long value)
+{
+    char buffer[24];
+    auto const result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    *this << std::string_view(buffer, result.ptr - buffer);
+}
+
+void LogLine::append_number(double value)
+{
+    char buffer[32];
+    auto const length = std::snprintf(buffer, sizeof(buffer), "%g", value);
+    *this << std::string_view(buffer, std::max(0, length));
+}
+
+bool RateLimit::allow()
+{
+    auto const now = std::chrono::steady_clock::now().time_since_epoch().count();
+    auto expected = next.load(std::memory_order_relaxed);
+    return now >= expected && next.compare_exchange_strong(expected, now + interval.count(), std::memory_order_relaxed);
+}
+
+void log_hex_dump(std::string_view label, unsigned char const* data, size_t size, size_t max_bytes)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    static constexpr size_t per_line = 32;
+
+    auto const shown = std::min(size, max_bytes);
+    LOG_DEBUG << label << ": " << size << " bytes" << (shown < size ? ", showing the first " : "") << (shown < size ? std::to_string(shown) : "");
+    for (size_t offset = 0; offset < shown; offset += per_line)
+    {
+        char line[per_line * 3];
+        size_t length = 0;
+        for (size_t i = offset; i < std::min(shown, offset + per_line); ++i)
+        {
+            line[length++] = digits[data[i] >> 4];
+            line[length++] = digits[data[i] & 0xf];
+            line[length++] = ' ';
+        }
+        LOG_DEBUG << "  " << as_hex(offset) << ": " << std::string_view(line, length);
+    }
+}
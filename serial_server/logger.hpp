@@ -0,0 +1,184 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+enum class LogLevel
+{
+    debug,
+    info,
+    warning,
+    error
+};
+
+/**
+ * "debug", "info", "warning" or "error"; throws std::runtime_error otherwise.
+ */
+LogLevel parse_log_level(std::string const& name);
+
+/**
+ * One formatted log line, at most max_length characters.
+ */
+struct LogRecord
+{
+    static constexpr size_t max_length = 240;
+
+    LogLevel level;
+    std::chrono::system_clock::time_point time;
+    uint16_t length;
+    char text[max_length];
+};
+
+/**
+ * Asynchronous leveled logger. Records are copied into a fixed ring of
+ * slots, a Vyukov bounded queue, so producers never lock or allocate; when
+ * the ring is full the line is dropped and counted. A background thread
+ * writes the lines to stderr in batches.
+ */
+class Logger
+{
+public:
+    static Logger & instance();
+
+    static bool enabled(LogLevel level)
+    {
+        return level >= threshold.load(std::memory_order_relaxed);
+    }
+
+    static void set_level(LogLevel level)
+    {
+        threshold.store(level, std::memory_order_relaxed);
+    }
+
+    void push(LogRecord const& record);
+
+    Logger(Logger const&) = delete;
+    Logger & operator=(Logger const&) = delete;
+
+private:
+    static constexpr size_t capacity = 1024;
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        LogRecord record;
+    };
+
+    Logger();
+    ~Logger();
+
+    bool pop(LogRecord & record);
+    void run();
+    void flush();
+
+    static std::atomic<LogLevel> threshold;
+
+    std::array<Slot, capacity> slots;
+    alignas(64) std::atomic<size_t> tail { 0 };
+    alignas(64) size_t head = 0;
+    std::atomic<uint64_t> dropped { 0 };
+    std::atomic<bool> running { true };
+    std::thread thread;
+};
+
+struct LogHex
+{
+    uint64_t value;
+};
+
+inline LogHex as_hex(uint64_t value)
+{
+    return LogHex { value };
+}
+
+/**
+ * Builds a record with stream syntax and queues it when destroyed. Use
+ * through the LOG_* macros, which skip formatting below the log level.
+ */
+class LogLine
+{
+public:
+    explicit LogLine(LogLevel level);
+    ~LogLine();
+
+    LogLine & operator<<(std::string_view text);
+    LogLine & operator<<(char c);
+    LogLine & operator<<(LogHex hex);
+
+    template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+    LogLine & operator<<(T value)
+    {
+        append_number(value);
+        return *this;
+    }
+
+private:
+    void append_number(long long value);
+    void append_number(unsigned long long value);
+    void append_number(double value);
+
+    template<typename T>
+    void append_number(T value)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            append_number(static_cast<double>(value));
+        }
+        else if constexpr (std::is_signed_v<T>)
+        {
+            append_number(static_cast<long long>(value));
+        }
+        else
+        {
+            append_number(static_cast<unsigned long long>(value));
+        }
+    }
+
+    LogRecord record;
+};
+
+/**
+ * Lets one event through per interval, for logging on hot paths.
+ */
+class RateLimit
+{
+public:
+    explicit RateLimit(std::chrono::steady_clock::duration interval)
+        : interval { interval }
+    {}
+
+    bool allow();
+
+private:
+    std::chrono::steady_clock::duration const interval;
+    std::atomic<std::chrono::steady_clock::rep> next { 0 };
+};
+
+/**
+ * Hex dump at debug level, 32 bytes per line, at most max_bytes.
+ */
+void log_hex_dump(std::string_view label, unsigned char const* data, size_t size, size_t max_bytes = 512);
+
+#define LOG_AT(level) if (!Logger::enabled(level)) {} else LogLine(level)
+#define LOG_DEBUG LOG_AT(LogLevel::debug)
+#define LOG_INFO LOG_AT(LogLevel::info)
+#define LOG_WARNING LOG_AT(LogLevel::warning)
+#define LOG_ERROR LOG_AT(LogLevel::error)
+
+// At most one dump per second from each call site.
+#define LOG_HEX_DUMP(label, data, size)                                                     \
+    do                                                                                      \
+    {                                                                                       \
+        static RateLimit hex_dump_limit { std::chrono::seconds(1) };                        \
+        if (Logger::enabled(LogLevel::debug) && hex_dump_limit.allow())                     \
+        {                                                                                   \
+            log_hex_dump(label, data, size);                                                \
+        }                                                                                   \
+    } while (false)
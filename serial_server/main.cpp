@@ -1,118 +1,430 @@
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <thread>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
 
 #include "HttpServer.h"
+#include "device.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "span_trace.hpp"
+#include "subscription_server.hpp"
+#include "read_plan.hpp"
+#include "state_codec.hpp"
+#include "state_frame.hpp"
 #include "super_metroid.hpp"
 #include "json11.hpp"
 #include "httplib.h"
 
+bool is_set(std::optional<size_t> id, WatchState const& state)
+{
+    return id && state[*id];
+}
+
+json11::Json device_to_json(Device const& device)
+{
+    auto const snapshot = device.sampler.latest();
+    auto const error = device.sampler.failure();
+    auto const status = device.source->status();
+    return json11::Json::object {
+        { "name", device.name },
+        { "source", device.source->describe() },
+        { "profile", device.profile.name },
+        { "available", !error },
+        { "status", status.empty() ? json11::Json() : json11::Json(status) },
+        { "error", error ? json11::Json(*error) : json11::Json() },
+        { "age_ms", snapshot ? json11::Json(static_cast<double>(snapshot->age().count())) : json11::Json() },
+    };
+}
+
+void reply_unavailable(Device const& device, std::string const& detail, httplib::Response & rsp)
+{
+    auto content = device_to_json(device).object_items();
+    content["error"] = "device unavailable";
+    content["detail"] = detail;
+    rsp.set_content(json11::Json(content).dump(), "json/application");
+    rsp.status = 503;
+}
+
+/**
+ * Answer 503 while the device's samples fail; its last state would look live.
+ */
+bool unavailable(Device const& device, httplib::Response & rsp)
+{
+    auto const error = device.sampler.failure();
+    if (error)
+    {
+        reply_unavailable(device, *error, rsp);
+    }
+    return static_cast<bool>(error);
+}
+
+/**
+ * Count a route's requests and time its handler, both per device and plain
+ * paths of a device route are reported as the plain path. The handler runs
+ * as a span of the client's trace, if it sent an X-Trace-Id; handlers that
+ * answer from a snapshot link the span to the sample's trace.
+ */
+template <typename Handler>
+auto instrumented(std::string const& route, Handler handler)
+{
+    auto & registry = MetricsRegistry::instance();
+    MetricLabels const labels { { "route", route } };
+    auto & requests = registry.counter("http_requests_total", "Requests served, by route", labels);
+    auto & errors = registry.counter("http_request_errors_total", "Requests answered with a status of 400 or more, by route", labels);
+    auto & latency = registry.histogram("http_request_duration_milliseconds", "Time spent in the route handler, by route",
+                                        exponential_buckets(0.05, 2, 16), labels);
+    return [route, handler, &requests, &errors, &latency](httplib::Request const& req, httplib::Response & rsp)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        TraceIdScope trace { req.has_header(SpanTracer::header) ? SpanTracer::parse_id(req.get_header_value(SpanTracer::header)) : 0 };
+        Span span(route);
+        handler(req, rsp);
+        latency.observe(std::chrono::steady_clock::now() - start);
+        requests.add();
+        if (rsp.status >= 400)
+        {
+            errors.add();
+        }
+    };
+}
+
+/**
+ * Serve a device route at /devices/<name><path>, and at <path> for the
+ * first device.
+ */
+template <typename Handler>
+void device_route(httplib::Server & svr, Devices const& devices, std::string const& path, Handler handler)
+{
+    svr.Get(path.c_str(), instrumented(path, [&devices, handler](auto const& req, auto & rsp)
+            {
+                handler(*devices.front(), req, rsp);
+            }));
+    svr.Get(("/devices/([^/]+)" + path).c_str(), instrumented(path, [&devices, handler](auto const& req, auto & rsp)
+            {
+                auto const name = req.matches[1].str();
+                auto const device = std::find_if(devices.begin(), devices.end(), [&name](auto const& d) { return d->name == name; });
+                if (device == devices.end())
+                {
+                    rsp.status = 404;
+                    return;
+                }
+                handler(**device, req, rsp);
+            }));
+}
+
 int main(int argc, char * argv[])
 {
-    if (argc != 2)
+    if (argc < 2 || (std::string(argv[1]) == "--config" && argc < 3))
     {
         std::cout << "Missing arguments\n";
+        std::cout << "Usage: " << argv[0] << " <source> [profile] [sample period ms] [read gap bytes] [record trace]\n";
+        std::cout << "       " << argv[0] << " --config <server config>\n";
+        std::cout << "Set LOG_LEVEL=debug|info|warning|error to change the log level without a config,\n";
+        std::cout << "and TRACE=1 to record spans for /trace.\n";
         return 0;
     }
 
+    ServerConfig config;
+    try
+    {
+        if (std::string(argv[1]) == "--config")
+        {
+            config = load_config(argv[2]);
+        }
+        else
+        {
+            DeviceConfig device;
+            device.name = "default";
+            device.source = argv[1];
+            if (argc > 2)
+            {
+                device.profile = argv[2];
+            }
+            if (argc > 3)
+            {
+                device.period = std::chrono::milliseconds(std::stoi(argv[3]));
+                if (device.period.count() <= 0)
+                {
+                    throw std::runtime_error("Sample period must be positive");
+                }
+            }
+            if (argc > 4)
+            {
+                device.gap_threshold = static_cast<uint32_t>(std::stoul(argv[4]));
+            }
+            if (argc > 5)
+            {
+                device.record = argv[5];
+            }
+            config.devices.push_back(device);
+            if (auto const level = std::getenv("LOG_LEVEL"))
+            {
+                config.log_level = parse_log_level(level);
+            }
+            if (auto const trace = std::getenv("TRACE"))
+            {
+                config.trace = std::string(trace) == "1";
+            }
+        }
+        Logger::set_level(config.log_level);
+        SpanTracer::enable(config.trace);
+    }
+    catch (std::exception const& e)
+    {
+        LOG_ERROR << e.what();
+        return 1;
+    }
+
+    Devices devices;
+    for (auto const& device_config : config.devices)
+    {
+        try
+        {
+            auto device = std::make_unique<Device>(device_config);
+            LOG_INFO << device->name << ": " << device->profile.watches.size() << " watches for " << device->profile.name
+                     << ", reading from " << device->source->describe();
+            for (auto const& region : device->plan)
+            {
+                LOG_INFO << device->name << ": Reading " << as_hex(region.address) << " +" << region.size;
+            }
+            MetricsRegistry::instance().gauge("snapshot_age_milliseconds", "Age of the latest published snapshot, NaN before the first",
+                                              { { "device", device->name } }, [&sampler = device->sampler]
+                                              {
+                                                  auto const snapshot = sampler.latest();
+                                                  return snapshot ? static_cast<double>(snapshot->age().count()) : std::nan("");
+                                              });
+            devices.push_back(std::move(device));
+        }
+        catch (std::exception const& e)
+        {
+            // Leave the other consoles running.
+            LOG_ERROR << device_config.name << ": " << e.what();
+        }
+    }
+    if (devices.empty())
+    {
+        return 1;
+    }
+
+    std::unique_ptr<SubscriptionServer> subscriptions;
+    if (config.ws_port)
+    {
+        try
+        {
+            subscriptions = std::make_unique<SubscriptionServer>(devices, config.address, config.ws_port);
+        }
+        catch (std::exception const& e)
+        {
+            // Polling clients are still served.
+            LOG_ERROR << "WebSocket: " << e.what();
+        }
+    }
+
     while (true)
     {
         try
         {
-            std::cout << "Starting server\n";
+            LOG_INFO << "Starting server";
 
             httplib::Server svr;
 
-            std::mutex mutex;
-
-            svr.Get("/state", [&argv, &mutex](auto const& req, auto & rsp)
+            svr.Get("/devices", instrumented("/devices", [&devices](auto const& req, auto & rsp)
                     {
-                        std::lock_guard guard(mutex);
-                        json11::Json::object obj;
-                        try
+                        json11::Json::array list;
+                        for (auto const& device : devices)
                         {
-                            auto port = open_port(argv[1]);
-                            if (!port)
-                            {
-                                return;
-                            }
+                            list.push_back(device_to_json(*device));
+                        }
+                        rsp.set_content(json11::Json(list).dump(), "json/application");
+                        rsp.status = 200;
+                    }));
+            svr.Get("/trace", [](auto const& req, auto & rsp)
+                    {
+                        if (!SpanTracer::enabled())
+                        {
+                            rsp.set_content("Tracing is off, set \"trace\": true in the config or TRACE=1\n", "text/plain");
+                            rsp.status = 404;
+                            return;
+                        }
+                        rsp.set_content(SpanTracer::instance().chrome_json(), "json/application");
+                        rsp.status = 200;
+                    });
+            svr.Get("/metrics", instrumented("/metrics", [](auto const& req, auto & rsp)
+                    {
+                        rsp.set_content(MetricsRegistry::instance().render(), "text/plain; version=0.0.4");
+                        rsp.status = 200;
+                    }));
+            device_route(svr, devices, "/device", [](Device & device, auto const& req, auto & rsp)
+                    {
+                        rsp.set_content(device_to_json(device).dump(), "json/application");
+                        rsp.status = 200;
+                    });
+            device_route(svr, devices, "/state", [](Device & device, auto const& req, auto & rsp)
+                    {
+                        if (unavailable(device, rsp))
+                        {
+                            return;
+                        }
 
-                            std::cout << "Got state request\n";
-                            auto sm_state = get_sm_state(port.get());
-                            for (auto & [key, value] : sm_state)
-                            {
-                                obj[key] = value;
-                            }
-                        } catch(std::exception const& e)
+                        auto const snapshot = device.sampler.latest();
+                        if (!snapshot)
                         {
-                            std::cerr << "Serial error: " << e.what() << '\n';
                             rsp.status = 404;
                             return;
                         }
+                        SpanTracer::link(snapshot->trace_id);
 
+                        // Binary for clients that ask for it, see StateFrame.
+                        rsp.set_header("Vary", "Accept");
+                        if (req.get_header_value("Accept").find(StateFrame::content_type) != std::string::npos)
+                        {
+                            rsp.set_content(state_to_frame(device.profile, snapshot->sequence, snapshot->timestamp, snapshot->state, snapshot->age()),
+                                            StateFrame::content_type);
+                        }
+                        else
+                        {
+                            rsp.set_content(state_to_json(device.profile, snapshot->state, snapshot->age()), "json/application");
+                        }
+                        rsp.status = 200;
+                    });
+            device_route(svr, devices, "/schema", [](Device & device, auto const& req, auto & rsp)
+                    {
+                        rsp.set_content(schema_to_json(device.profile), "json/application");
+                        rsp.status = 200;
+                    });
+            device_route(svr, devices, "/game_started", [](Device & device, auto const& req, auto & rsp)
+                    {
+                        if (unavailable(device, rsp))
+                        {
+                            return;
+                        }
 
-                        auto jsn = json11::Json(obj).dump();
+                        auto const snapshot = device.sampler.latest();
+                        if (!snapshot)
+                        {
+                            rsp.status = 404;
+                            return;
+                        }
+                        SpanTracer::link(snapshot->trace_id);
 
-                        rsp.set_content(jsn, "json/application");
+                        auto const started = is_set(device.profile.start_watch, snapshot->state);
+                        rsp.set_content(flag_to_json("started", started, snapshot->age()), "json/application");
                         rsp.status = 200;
-                        std::cout << "Setting rsp\n";
                     });
-            svr.Get("/game_started", [&argv, &mutex](auto const& req, auto & rsp)
+            device_route(svr, devices, "/game_ended", [](Device & device, auto const& req, auto & rsp)
                     {
-                        std::lock_guard<std::mutex> guard(mutex);
-                        bool started = false;
-                        try
+                        if (unavailable(device, rsp))
                         {
-                            auto port = open_port(argv[1]);
-                            if (!port)
-                            {
-                                return;
-                            }
-                            std::cout << "Got /game_started request\n";
-                            started = game_started(port.get());
-                        } catch(std::exception const& e)
+                            return;
+                        }
+
+                        auto const snapshot = device.sampler.latest();
+                        if (!snapshot)
                         {
-                            std::cerr << "Serial error: " << e.what() << '\n';
                             rsp.status = 404;
                             return;
                         }
+                        SpanTracer::link(snapshot->trace_id);
 
-                        std::cout << "Game started: " << started << '\n';
+                        auto const ended = is_set(device.profile.end_watch, snapshot->state);
+                        rsp.set_content(flag_to_json("ended", ended, snapshot->age()), "json/application");
+                        rsp.status = 200;
+                    });
+            device_route(svr, devices, "/event_log", [](Device & device, auto const& req, auto & rsp)
+                    {
+                        uint64_t since = 0;
+                        if (req.has_param("since"))
+                        {
+                            since = std::strtoull(req.get_param_value("since").c_str(), nullptr, 10);
+                        }
 
-                        auto content = json11::Json(json11::Json::object({{"started", started}})).dump();
-                        rsp.set_content(content, "json/application");
+                        bool missed = false;
+                        auto const log = device.events.since(since, &missed);
+                        if (missed)
+                        {
+                            rsp.set_content(events_lost_to_json(device.events.last_sequence()), "json/application");
+                            rsp.status = 410;
+                            return;
+                        }
+                        auto const last = log.empty() ? since : log.back().sequence;
+                        rsp.set_content(events_to_json(device.profile, log, last), "json/application");
                         rsp.status = 200;
                     });
-            svr.Get("/game_ended", [&argv, &mutex](auto const& req, auto & rsp)
+            device_route(svr, devices, "/events", [](Device & device, auto const& req, auto & rsp)
                     {
-                        std::lock_guard<std::mutex> guard(mutex);
-                        bool ended = false;
-                        try
+                        auto cursor = std::make_shared<uint64_t>(0);
+                        if (req.has_header("Last-Event-ID"))
+                        {
+                            *cursor = std::strtoull(req.get_header_value("Last-Event-ID").c_str(), nullptr, 10);
+                        }
+                        else if (req.has_param("since"))
+                        {
+                            *cursor = std::strtoull(req.get_param_value("since").c_str(), nullptr, 10);
+                        }
+
+                        rsp.set_header("Content-Type", "text/event-stream");
+                        rsp.set_header("Cache-Control", "no-cache");
+                        // Runs on this connection's thread until the client goes away.
+                        rsp.streamcb = [&device, cursor](uint64_t)
                         {
-                            auto port = open_port(argv[1]);
-                            if (!port)
+                            using namespace std::chrono_literals;
+                            bool missed = false;
+                            auto const log = device.events.wait_since(*cursor, 15s, &missed);
+                            std::string out;
+                            if (missed)
+                            {
+                                *cursor = log.empty() ? device.events.last_sequence() : log.front().sequence - 1;
+                                out = events_lost_to_sse(*cursor);
+                            }
+                            if (log.empty())
                             {
-                                return;
+                                // Comment line, keeps proxies open and detects dead clients.
+                                return out.empty() ? std::string(": keep-alive\n\n") : out;
                             }
-                            std::cout << "Got /game_ended \n";
-                            ended = entered_ship(port.get());
-                            std::cout << "Game ended: " << ended << '\n';
 
+                            *cursor = log.back().sequence;
+                            return out + events_to_sse(device.profile, log);
+                        };
+                        rsp.status = 200;
+                    });
+            device_route(svr, devices, "/snapshot", [](Device & device, auto const& req, auto & rsp)
+                    {
+                        std::string content = "{\"state\":";
+                        try
+                        {
+                            LOG_DEBUG << "Got /snapshot request for " << device.name;
+                            auto const state = device.profile.evaluate(SramData { device.plan, device.source->read(device.plan) });
+
+                            append_state_members(content, device.profile, state);
+                            content += "},\"started\":";
+                            content += is_set(device.profile.start_watch, state) ? "true" : "false";
+                            content += ",\"ended\":";
+                            content += is_set(device.profile.end_watch, state) ? "true" : "false";
+                            content += '}';
                         } catch(std::exception const& e)
                         {
-                            std::cerr << "Serial error: " << e.what() << '\n';
-                            rsp.status = 404;
+                            LOG_WARNING << device.name << ": Serial error: " << e.what();
+                            reply_unavailable(device, e.what(), rsp);
                             return;
                         }
 
-                        auto content = json11::Json(json11::Json::object({{"ended", ended}})).dump();
                         rsp.set_content(content, "json/application");
                         rsp.status = 200;
                     });
 
-            svr.listen("192.168.1.10", 8080);
+            svr.listen(config.address.c_str(), config.port);
+            LOG_ERROR << "Could not listen on " << config.address << ':' << config.port;
         } catch (std::exception const& e) {
-            std::cerr << "Exception: " << e.what() << '\n';
+            LOG_ERROR << "Exception: " << e.what();
         }
+        // Device failures no longer reach this loop, only a failed listen
+        // does; do not spin on it.
+        std::this_thread::sleep_for(std::chrono::seconds(1));
     }
 }
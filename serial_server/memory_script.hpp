@@ -0,0 +1,102 @@
+#pragma once
+
+// Timed memory writes shared by the stand-in devices (mock_snes, fake_wram,
+// the emulator protocol stand-ins). One step per line:
+//
+//   <ms> <address> <byte> [byte...]
+//
+// ms is decimal, address and bytes are hex. '#' starts a comment.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct ScriptStep
+{
+    std::chrono::milliseconds at;
+    uint32_t address;
+    std::vector<unsigned char> bytes;
+};
+
+inline std::vector<ScriptStep> load_script(std::string const& path)
+{
+    std::vector<ScriptStep> steps;
+    if (path.empty())
+    {
+        return steps;
+    }
+
+    std::ifstream f(path);
+    if (!f)
+    {
+        throw std::runtime_error("Could not open script " + path);
+    }
+
+    std::string line;
+    while (std::getline(f, line))
+    {
+        std::istringstream is(line.substr(0, line.find('#')));
+        long ms;
+        if (!(is >> ms))
+        {
+            continue;
+        }
+
+        ScriptStep step { std::chrono::milliseconds(ms), 0, {} };
+        is >> std::hex >> step.address;
+        unsigned int byte;
+        while (is >> byte)
+        {
+            step.bytes.push_back(static_cast<unsigned char>(byte));
+        }
+        steps.push_back(std::move(step));
+    }
+
+    std::stable_sort(steps.begin(), steps.end(), [](auto const& a, auto const& b) { return a.at < b.at; });
+    return steps;
+}
+
+/**
+ * Plays a script against a memory image. apply_due writes every step whose
+ * time has come; next_timeout_ms is how long to wait for the one after,
+ * -1 when the script is done.
+ */
+class ScriptPlayer
+{
+public:
+    explicit ScriptPlayer(std::vector<ScriptStep> steps)
+        : steps { std::move(steps) }
+        , next { this->steps.begin() }
+        , start { std::chrono::steady_clock::now() }
+    {}
+
+    template<typename Write>
+    void apply_due(Write && write)
+    {
+        auto const elapsed = std::chrono::steady_clock::now() - start;
+        for (; next != steps.end() && next->at <= elapsed; ++next)
+        {
+            write(next->address, next->bytes);
+        }
+    }
+
+    int next_timeout_ms() const
+    {
+        if (next == steps.end())
+        {
+            return -1;
+        }
+        auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(next->at - (std::chrono::steady_clock::now() - start));
+        return std::max(0, static_cast<int>(left.count()) + 1);
+    }
+
+private:
+    std::vector<ScriptStep> const steps;
+    std::vector<ScriptStep>::const_iterator next;
+    std::chrono::steady_clock::time_point const start;
+};
@@ -0,0 +1,171 @@
+#include "memory_source.hpp"
+
+#include <algorithm>
+
+#include "asio_serial_source.hpp"
+#include "device_session.hpp"
+#include "logger.hpp"
+#include "process_source.hpp"
+#include "retroarch_source.hpp"
+#include "trace_file.hpp"
+#include "usb2snes_source.hpp"
+
+std::future<RegionData> MemorySource::read_async(std::vector<SramRegion> regions)
+{
+    return std::async(std::launch::async, [this, regions = std::move(regions)] { return read(regions); });
+}
+
+std::string MemorySource::status() const
+{
+    return {};
+}
+
+namespace
+{
+
+std::unique_ptr<MemorySource> create_memory_source(std::string const& uri)
+{
+    auto const colon = uri.find(':');
+    auto const scheme = colon == std::string::npos ? std::string() : uri.substr(0, colon);
+    auto const target = colon == std::string::npos ? uri : uri.substr(colon + 1);
+
+    if (scheme == "replay")
+    {
+        auto trace = target;
+        double speed = 1;
+        auto const at = trace.rfind('@');
+        if (at != std::string::npos)
+        {
+            speed = std::stod(trace.substr(at + 1));
+            trace.erase(at);
+        }
+        return std::make_unique<TraceReplay>(trace, speed);
+    }
+    if (scheme == "pid")
+    {
+        return make_process_source(target);
+    }
+    if (scheme == "retroarch")
+    {
+        return make_retroarch_source(target);
+    }
+    if (scheme == "usb2snes")
+    {
+        return make_usb2snes_source(target);
+    }
+    if (scheme == "asio")
+    {
+        return make_asio_serial_source(target);
+    }
+    if (scheme == "serial")
+    {
+        return make_device_session(target);
+    }
+    if (scheme.empty() || scheme.find('/') != std::string::npos)
+    {
+        // A plain device path.
+        return make_device_session(uri);
+    }
+
+    throw SourceConfigError("Unknown memory source: " + uri);
+}
+
+}
+
+std::unique_ptr<MemorySource> make_memory_source(std::string const& uri)
+{
+    try
+    {
+        return create_memory_source(uri);
+    }
+    catch (std::logic_error const& e)
+    {
+        // std::stoul and friends on a malformed value.
+        throw SourceConfigError("Bad memory source " + uri + ": " + e.what());
+    }
+}
+
+namespace
+{
+
+constexpr std::chrono::milliseconds min_retry { 500 };
+constexpr std::chrono::milliseconds max_retry { 8000 };
+
+}
+
+RetryingSource::RetryingSource(std::string uri, std::string error)
+    : uri { std::move(uri) }
+    , error { std::move(error) }
+    , backoff { min_retry }
+    , next_attempt { std::chrono::steady_clock::now() + min_retry }
+{}
+
+MemorySource * RetryingSource::created()
+{
+    if (auto const existing = ready.load())
+    {
+        return existing;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+    auto const now = std::chrono::steady_clock::now();
+    if (!source && now >= next_attempt)
+    {
+        try
+        {
+            source = make_memory_source(uri);
+            ready = source.get();
+            LOG_INFO << "Source: Created " << source->describe();
+        }
+        catch (std::exception const& e)
+        {
+            error = e.what();
+            backoff = std::min(backoff * 2, max_retry);
+            next_attempt = now + backoff;
+        }
+    }
+    if (!source)
+    {
+        throw SourceUnavailable(error);
+    }
+    return source.get();
+}
+
+RegionData RetryingSource::read(std::vector<SramRegion> const& regions)
+{
+    return created()->read(regions);
+}
+
+std::future<RegionData> RetryingSource::read_async(std::vector<SramRegion> regions)
+{
+    return created()->read_async(std::move(regions));
+}
+
+std::string RetryingSource::describe() const
+{
+    auto const existing = ready.load();
+    return existing ? existing->describe() : uri;
+}
+
+std::string RetryingSource::status() const
+{
+    auto const existing = ready.load();
+    return existing ? existing->status() : "unavailable";
+}
+
+std::unique_ptr<MemorySource> open_memory_source(std::string const& uri)
+{
+    try
+    {
+        return make_memory_source(uri);
+    }
+    catch (SourceConfigError const&)
+    {
+        throw;
+    }
+    catch (std::exception const& e)
+    {
+        LOG_WARNING << "Source: " << uri << ": " << e.what() << ", retrying";
+        return std::make_unique<RetryingSource>(uri, e.what());
+    }
+}
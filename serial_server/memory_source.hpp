@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "super_metroid.hpp"
+
+/**
+ * Bytes read for each requested region, in request order.
+ */
+using RegionData = std::vector<std::vector<unsigned char>>;
+
+/**
+ * Thrown without attempting any I/O while a source knows it cannot be
+ * read, e.g. its device is unplugged or a reconnect is backing off.
+ */
+class SourceUnavailable : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * Thrown for a source URI that can never work, such as an unknown scheme,
+ * an unknown option or a malformed value. Unlike failing to open the
+ * source, retrying does not help.
+ */
+class SourceConfigError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * Somewhere SNES memory can be read from: a USB serial device, a recorded
+ * trace, an emulator. Addresses are in the usb2snes SNES address space,
+ * WRAM starts at 0xf50000.
+ */
+class MemorySource
+{
+public:
+    virtual ~MemorySource() = default;
+
+    /**
+     * Read every region, batched into as few exchanges as the backend
+     * allows. Throws std::runtime_error when the source cannot be read.
+     */
+    virtual RegionData read(std::vector<SramRegion> const& regions) = 0;
+
+    /**
+     * Start a read and return at once. The default runs read() on another
+     * thread; backends with their own I/O loop complete it from there.
+     */
+    virtual std::future<RegionData> read_async(std::vector<SramRegion> regions);
+
+    /**
+     * Human readable description, the URI the source was created from.
+     */
+    virtual std::string describe() const = 0;
+
+    /**
+     * Short link state such as "connected" or "unplugged", empty for
+     * sources without a link of their own.
+     */
+    virtual std::string status() const;
+};
+
+/**
+ * Create a source from a URI:
+ *
+ *   /dev/ttyACM0, serial:/dev/ttyACM0   USB serial device
+ *   asio:/dev/ttyACM0                   USB serial device, non-blocking and pipelined
+ *   replay:run.trace[@speed]            recorded trace
+ *   pid:1234?base=0x...                 emulator process, WRAM at a known address
+ *   pid:1234?signature=<hex>&offset=n   emulator process, WRAM found by signature
+ *   retroarch:host[:port][?command=ram] RetroArch network commands over UDP
+ *   usb2snes:host[:port][?device=name]  usb2snes WebSocket server (QUsb2Snes, SNI)
+ *
+ * Both serial sources take ?floor=ms&timeout=ms&factor=x to bound their
+ * adaptive request deadlines, see RttEstimator.
+ *
+ * Throws SourceConfigError for a malformed URI, std::runtime_error when
+ * the source cannot be opened.
+ */
+std::unique_ptr<MemorySource> make_memory_source(std::string const& uri);
+
+/**
+ * Stands in for a source that could not be created yet, e.g. an emulator
+ * that is not running. Reads fail with SourceUnavailable; once the retry
+ * delay has passed a read tries to create the source again, with
+ * exponential backoff. After that every call goes to the created source.
+ */
+class RetryingSource : public MemorySource
+{
+public:
+    RetryingSource(std::string uri, std::string error);
+
+    RegionData read(std::vector<SramRegion> const& regions) override;
+    std::future<RegionData> read_async(std::vector<SramRegion> regions) override;
+    std::string describe() const override;
+    std::string status() const override;
+
+private:
+    MemorySource * created();
+
+    std::string const uri;
+    std::mutex mutex;
+    std::unique_ptr<MemorySource> source;
+    std::atomic<MemorySource *> ready { nullptr };
+    std::string error;
+    std::chrono::milliseconds backoff;
+    std::chrono::steady_clock::time_point next_attempt;
+};
+
+/**
+ * make_memory_source for long running owners: a source that cannot be
+ * opened now is logged and retried through a RetryingSource. A malformed
+ * URI still throws SourceConfigError.
+ */
+std::unique_ptr<MemorySource> open_memory_source(std::string const& uri);
@@ -0,0 +1,239 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+namespace
+{
+
+constexpr double sum_scale = 1e6;
+
+std::string render_labels(MetricLabels const& labels)
+{
+    if (labels.empty())
+    {
+        return {};
+    }
+
+    std::string text = "{";
+    for (auto const& [key, value] : labels)
+    {
+        if (text.size() > 1)
+        {
+            text += ',';
+        }
+        text += key;
+        text += "=\"";
+        for (auto const c : value)
+        {
+            if (c == '\\' || c == '"')
+            {
+                text += '\\';
+                text += c;
+            }
+            else if (c == '\n')
+            {
+                text += "\\n";
+            }
+            else
+            {
+                text += c;
+            }
+        }
+        text += '"';
+    }
+    text += '}';
+    return text;
+}
+
+// Adds a label to an already rendered label set.
+std::string with_label(std::string const& labels, std::string const& extra)
+{
+    if (labels.empty())
+    {
+        return '{' + extra + '}';
+    }
+    return labels.substr(0, labels.size() - 1) + ',' + extra + '}';
+}
+
+std::string format_number(double value)
+{
+    if (std::isinf(value))
+    {
+        return value > 0 ? "+Inf" : "-Inf";
+    }
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.10g", value);
+    return buffer;
+}
+
+}
+
+size_t metrics_detail::shard_index()
+{
+    static std::atomic<size_t> next { 0 };
+    thread_local size_t const index = next.fetch_add(1, std::memory_order_relaxed) % shard_count;
+    return index;
+}
+
+uint64_t Counter::value() const
+{
+    uint64_t total = 0;
+    for (auto const& shard : shards)
+    {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+// Cells 0 to bounds are the buckets, +Inf last; the cell behind them is the sum.
+Histogram::Histogram(std::vector<double> bounds)
+    : upper_bounds { std::move(bounds) }
+    , lines_per_shard { (upper_bounds.size() + 2 + 7) / 8 }
+    , lines(lines_per_shard * metrics_detail::shard_count)
+{
+    if (!std::is_sorted(upper_bounds.begin(), upper_bounds.end()))
+    {
+        throw std::runtime_error("Histogram bounds must be sorted");
+    }
+}
+
+std::atomic<uint64_t> & Histogram::cell(size_t shard, size_t index)
+{
+    return lines[shard * lines_per_shard + index / 8].cells[index % 8];
+}
+
+std::atomic<uint64_t> const& Histogram::cell(size_t shard, size_t index) const
+{
+    return lines[shard * lines_per_shard + index / 8].cells[index % 8];
+}
+
+void Histogram::observe(double value)
+{
+    auto const bucket = static_cast<size_t>(std::lower_bound(upper_bounds.begin(), upper_bounds.end(), value) - upper_bounds.begin());
+    auto const shard = metrics_detail::shard_index();
+    cell(shard, bucket).fetch_add(1, std::memory_order_relaxed);
+    // Two's complement, a negative observation wraps back when summed.
+    cell(shard, upper_bounds.size() + 1).fetch_add(static_cast<uint64_t>(std::llround(value * sum_scale)), std::memory_order_relaxed);
+}
+
+Histogram::Totals Histogram::totals() const
+{
+    Totals totals;
+    totals.buckets.assign(upper_bounds.size() + 1, 0);
+    uint64_t sum = 0;
+    for (size_t shard = 0; shard < metrics_detail::shard_count; ++shard)
+    {
+        for (size_t i = 0; i <= upper_bounds.size(); ++i)
+        {
+            totals.buckets[i] += cell(shard, i).load(std::memory_order_relaxed);
+        }
+        sum += cell(shard, upper_bounds.size() + 1).load(std::memory_order_relaxed);
+    }
+
+    for (size_t i = 1; i < totals.buckets.size(); ++i)
+    {
+        totals.buckets[i] += totals.buckets[i - 1];
+    }
+    totals.sum = static_cast<double>(static_cast<int64_t>(sum)) / sum_scale;
+    return totals;
+}
+
+std::vector<double> exponential_buckets(double start, double factor, size_t count)
+{
+    std::vector<double> bounds;
+    for (size_t i = 0; i < count; ++i)
+    {
+        bounds.push_back(start);
+        start *= factor;
+    }
+    return bounds;
+}
+
+MetricsRegistry & MetricsRegistry::instance()
+{
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::Family & MetricsRegistry::family(std::string const& name, std::string const& help, std::string const& type)
+{
+    auto & family = families[name];
+    if (family.type.empty())
+    {
+        family.help = help;
+        family.type = type;
+    }
+    else if (family.type != type)
+    {
+        throw std::runtime_error("Metric " + name + " registered as " + family.type + " and " + type);
+    }
+    return family;
+}
+
+Counter & MetricsRegistry::counter(std::string const& name, std::string const& help, MetricLabels const& labels)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    auto & instrument = family(name, help, "counter").counters[render_labels(labels)];
+    if (!instrument)
+    {
+        instrument = std::make_unique<Counter>();
+    }
+    return *instrument;
+}
+
+Histogram & MetricsRegistry::histogram(std::string const& name, std::string const& help, std::vector<double> const& bounds,
+                                       MetricLabels const& labels)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    auto & instrument = family(name, help, "histogram").histograms[render_labels(labels)];
+    if (!instrument)
+    {
+        instrument = std::make_unique<Histogram>(bounds);
+    }
+    return *instrument;
+}
+
+void MetricsRegistry::gauge(std::string const& name, std::string const& help, MetricLabels const& labels, std::function<double()> read)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    family(name, help, "gauge").gauges[render_labels(labels)] = std::move(read);
+}
+
+std::string MetricsRegistry::render() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+
+    std::string text;
+    for (auto const& [name, family] : families)
+    {
+        text += "# HELP " + name + ' ' + family.help + '\n';
+        text += "# TYPE " + name + ' ' + family.type + '\n';
+
+        for (auto const& [labels, counter] : family.counters)
+        {
+            text += name + labels + ' ' + std::to_string(counter->value()) + '\n';
+        }
+
+        for (auto const& [labels, read] : family.gauges)
+        {
+            text += name + labels + ' ' + format_number(read()) + '\n';
+        }
+
+        for (auto const& [labels, histogram] : family.histograms)
+        {
+            auto const totals = histogram->totals();
+            auto const& bounds = histogram->bounds();
+            for (size_t i = 0; i < totals.buckets.size(); ++i)
+            {
+                auto const le = i < bounds.size() ? format_number(bounds[i]) : std::string("+Inf");
+                text += name + "_bucket" + with_label(labels, "le=\"" + le + '"') + ' ' + std::to_string(totals.buckets[i]) + '\n';
+            }
+            text += name + "_sum" + labels + ' ' + format_number(totals.sum) + '\n';
+            text += name + "_count" + labels + ' ' + std::to_string(totals.buckets.back()) + '\n';
+        }
+    }
+    return text;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+namespace metrics_detail
+{
+
+constexpr size_t shard_count = 16;
+
+/**
+ * The calling thread's shard. Threads are spread round robin, so with at
+ * most shard_count busy threads no two of them share a cache line.
+ */
+size_t shard_index();
+
+struct alignas(64) CounterShard
+{
+    std::atomic<uint64_t> value { 0 };
+};
+
+}
+
+/**
+ * Monotonic counter. Each thread adds to its own shard with a relaxed
+ * atomic, shards are only summed when the metrics are scraped.
+ */
+class Counter
+{
+public:
+    void add(uint64_t n = 1)
+    {
+        shards[metrics_detail::shard_index()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const;
+
+private:
+    std::array<metrics_detail::CounterShard, metrics_detail::shard_count> shards;
+};
+
+/**
+ * Histogram over fixed upper bounds, sharded like Counter: every shard has
+ * its own cache lines with a cell per bucket and one for the sum. The sum
+ * is kept in integer micro-units so it can be added to without a CAS loop.
+ */
+class Histogram
+{
+public:
+    explicit Histogram(std::vector<double> bounds);
+
+    void observe(double value);
+
+    void observe(std::chrono::steady_clock::duration duration)
+    {
+        observe(std::chrono::duration<double, std::milli>(duration).count());
+    }
+
+    struct Totals
+    {
+        std::vector<uint64_t> buckets; // cumulative, the last one is +Inf
+        double sum = 0;
+    };
+
+    std::vector<double> const& bounds() const
+    {
+        return upper_bounds;
+    }
+
+    Totals totals() const;
+
+private:
+    struct alignas(64) Line
+    {
+        std::atomic<uint64_t> cells[8] = {};
+    };
+
+    std::atomic<uint64_t> & cell(size_t shard, size_t index);
+    std::atomic<uint64_t> const& cell(size_t shard, size_t index) const;
+
+    std::vector<double> const upper_bounds;
+    size_t const lines_per_shard;
+    std::vector<Line> lines;
+};
+
+/**
+ * Exponential bucket bounds: start, start * factor, ... (count bounds).
+ */
+std::vector<double> exponential_buckets(double start, double factor, size_t count);
+
+/**
+ * Process wide metrics, rendered in the Prometheus text format.
+ *
+ * Instruments are registered once, typically when their owner is built,
+ * and live as long as the process; registering the same name and labels
+ * again returns the same instrument. Only registration and scraping lock,
+ * the hot path just touches the returned reference.
+ */
+class MetricsRegistry
+{
+public:
+    static MetricsRegistry & instance();
+
+    Counter & counter(std::string const& name, std::string const& help, MetricLabels const& labels = {});
+    Histogram & histogram(std::string const& name, std::string const& help, std::vector<double> const& bounds,
+                          MetricLabels const& labels = {});
+
+    /**
+     * A value computed when scraped, such as an age.
+     */
+    void gauge(std::string const& name, std::string const& help, MetricLabels const& labels, std::function<double()> read);
+
+    std::string render() const;
+
+private:
+    MetricsRegistry() = default;
+
+    struct Family
+    {
+        std::string help;
+        std::string type;
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+        std::map<std::string, std::function<double()>> gauges;
+    };
+
+    Family & family(std::string const& name, std::string const& help, std::string const& type);
+
+    mutable std::mutex mutex;
+    std::map<std::string, Family> families;
+};
@@ -0,0 +1,387 @@
+// Stand-in for an SNES serial device on a pseudo-terminal. It answers the
+// USBA GET and VGET frames sent by read_sram_multi from a memory image that
+// a script can change over time, so serial_server can run without hardware:
+//
+//   mock_snes [--link path] [--image file@address] [--script file]
+//             [--byte-us n] [--drop p] [--corrupt p] [--truncate p] [--seed n]
+//
+// The script format is described in memory_script.hpp.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "memory_script.hpp"
+
+namespace
+{
+
+volatile std::sig_atomic_t running = 1;
+
+constexpr unsigned char op_get = 0;
+constexpr unsigned char op_vget = 2;
+constexpr unsigned char op_response = 15;
+
+// The USBA address space is 24 bits wide.
+constexpr size_t memory_size = 1 << 24;
+
+struct Options
+{
+    std::string link;
+    std::vector<std::pair<std::string, uint32_t>> images;
+    std::string script;
+    unsigned int byte_us = 0;
+    double drop = 0;
+    double corrupt = 0;
+    double truncate = 0;
+    unsigned int seed = 1;
+};
+
+Options parse_options(int argc, char * argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i += 2)
+    {
+        std::string const key = argv[i];
+        if (i + 1 == argc)
+        {
+            throw std::runtime_error(key + " expects a value");
+        }
+        std::string const value = argv[i + 1];
+        if (key == "--link")
+        {
+            options.link = value;
+        }
+        else if (key == "--image")
+        {
+            auto const at = value.rfind('@');
+            if (at == std::string::npos)
+            {
+                throw std::runtime_error("--image expects file@address");
+            }
+            auto const address = std::stoul(value.substr(at + 1), nullptr, 16);
+            if (address >= memory_size)
+            {
+                throw std::runtime_error("--image address must be below 1000000");
+            }
+            options.images.emplace_back(value.substr(0, at), static_cast<uint32_t>(address));
+        }
+        else if (key == "--script")
+        {
+            options.script = value;
+        }
+        else if (key == "--byte-us")
+        {
+            options.byte_us = std::stoul(value);
+        }
+        else if (key == "--drop")
+        {
+            options.drop = std::stod(value);
+        }
+        else if (key == "--corrupt")
+        {
+            options.corrupt = std::stod(value);
+        }
+        else if (key == "--truncate")
+        {
+            options.truncate = std::stod(value);
+        }
+        else if (key == "--seed")
+        {
+            options.seed = std::stoul(value);
+        }
+        else
+        {
+            throw std::runtime_error("Unknown option " + key);
+        }
+    }
+    return options;
+}
+
+uint32_t read_be32(unsigned char const* p)
+{
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | uint32_t(p[3]);
+}
+
+void write_all(int fd, unsigned char const* data, size_t size)
+{
+    while (size)
+    {
+        auto const written = ::write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+            {
+                pollfd pfd { fd, POLLOUT, 0 };
+                ::poll(&pfd, 1, 100);
+                continue;
+            }
+            // Nobody has the port open, the response is lost like on real hardware.
+            return;
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+class MockDevice
+{
+public:
+    MockDevice(Options options)
+        : options { std::move(options) }
+        , memory(memory_size)
+        , random { this->options.seed }
+    {
+        for (auto const& [file, address] : this->options.images)
+        {
+            std::ifstream f(file, std::ios::binary);
+            std::vector<char> const image((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+            auto const count = std::min(image.size(), memory.size() - address);
+            std::copy_n(image.begin(), count, memory.begin() + address);
+            std::cout << "Loaded " << count << " bytes from " << file << " at " << std::hex << address << std::dec << '\n';
+        }
+
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+        {
+            throw std::runtime_error("Could not create pseudo-terminal");
+        }
+        fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+        slave_path = ptsname(master);
+        // Keep the slave open so the master does not see a hangup between
+        // client connections, and make it raw like a USB CDC device.
+        slave = ::open(slave_path.c_str(), O_RDWR | O_NOCTTY);
+        termios tio {};
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+
+        if (!this->options.link.empty())
+        {
+            ::unlink(this->options.link.c_str());
+            if (::symlink(slave_path.c_str(), this->options.link.c_str()) != 0)
+            {
+                throw std::runtime_error("Could not create link " + this->options.link);
+            }
+        }
+    }
+
+    ~MockDevice()
+    {
+        if (!options.link.empty())
+        {
+            ::unlink(options.link.c_str());
+        }
+        ::close(slave);
+        ::close(master);
+    }
+
+    std::string const& path() const
+    {
+        return slave_path;
+    }
+
+    void run(std::vector<ScriptStep> script)
+    {
+        ScriptPlayer player(std::move(script));
+
+        while (running)
+        {
+            player.apply_due([this](uint32_t address, std::vector<unsigned char> const& bytes)
+            {
+                for (size_t i = 0; i < bytes.size(); ++i)
+                {
+                    memory[(address + i) & 0xffffff] = bytes[i];
+                }
+                std::cout << "Script: " << std::hex << address << std::dec << " <- " << bytes.size() << " bytes\n";
+            });
+
+            pollfd pfd { master, POLLIN, 0 };
+            if (::poll(&pfd, 1, player.next_timeout_ms()) <= 0 || !(pfd.revents & POLLIN))
+            {
+                continue;
+            }
+
+            unsigned char chunk[4096];
+            auto const received = ::read(master, chunk, sizeof(chunk));
+            if (received > 0)
+            {
+                pending.insert(pending.end(), chunk, chunk + received);
+                process();
+            }
+        }
+    }
+
+private:
+    bool roll(double probability)
+    {
+        return probability > 0 && std::uniform_real_distribution<>(0, 1)(random) < probability;
+    }
+
+    void process()
+    {
+        while (true)
+        {
+            // Resynchronise on the next header if the host sent garbage.
+            auto const magic = std::search(pending.begin(), pending.end(), std::begin(usba), std::end(usba) - 1);
+            if (magic == pending.end())
+            {
+                // The header may be split across reads, keep what could be its start.
+                pending.erase(pending.begin(), pending.end() - std::min<size_t>(pending.size(), sizeof(usba) - 2));
+                return;
+            }
+            pending.erase(pending.begin(), magic);
+            if (pending.size() < 7)
+            {
+                return;
+            }
+
+            auto const opcode = pending[4];
+            size_t const frame_size = opcode == op_vget ? 64 : 512;
+            if (pending.size() < frame_size)
+            {
+                return;
+            }
+
+            std::vector<unsigned char> const frame(pending.begin(), pending.begin() + frame_size);
+            pending.erase(pending.begin(), pending.begin() + frame_size);
+
+            if (roll(options.drop))
+            {
+                std::cout << "Fault: dropped request\n";
+                continue;
+            }
+
+            if (opcode == op_get)
+            {
+                answer_get(frame);
+            }
+            else if (opcode == op_vget)
+            {
+                answer_vget(frame);
+            }
+            else
+            {
+                std::cout << "Ignoring opcode " << int(opcode) << '\n';
+            }
+        }
+    }
+
+    void answer_get(std::vector<unsigned char> const& frame)
+    {
+        auto const size = read_be32(&frame[252]);
+        auto const address = read_be32(&frame[256]);
+
+        std::vector<unsigned char> response(512);
+        std::copy(std::begin(usba), std::end(usba) - 1, response.begin());
+        response[4] = op_response;
+        response[5] = frame[5];
+        std::copy(&frame[252], &frame[256], &response[252]);
+
+        append_memory(response, address, size);
+        send(response, 512 + size);
+    }
+
+    void answer_vget(std::vector<unsigned char> const& frame)
+    {
+        std::vector<unsigned char> response;
+        uint32_t total = 0;
+        for (size_t entry = 32; entry < 64; entry += 4)
+        {
+            uint32_t const size = frame[entry];
+            if (!size)
+            {
+                break;
+            }
+            uint32_t const address = uint32_t(frame[entry + 1]) << 16 | uint32_t(frame[entry + 2]) << 8 | frame[entry + 3];
+            append_memory(response, address, size);
+            total += size;
+        }
+        send(response, total);
+    }
+
+    void append_memory(std::vector<unsigned char> & out, uint32_t address, uint32_t size)
+    {
+        for (uint32_t i = 0; i < size; ++i)
+        {
+            out.push_back(memory[(address + i) & 0xffffff]);
+        }
+    }
+
+    void send(std::vector<unsigned char> & response, uint32_t payload)
+    {
+        // Payload goes out in 64 byte blocks.
+        response.resize((response.size() + 63) / 64 * 64);
+
+        if (options.byte_us)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(options.byte_us) * payload);
+        }
+
+        if (roll(options.corrupt))
+        {
+            std::cout << "Fault: corrupted response\n";
+            response[0] ^= 0xff;
+            response[response.size() / 2] ^= 0xff;
+        }
+
+        auto size = response.size();
+        if (roll(options.truncate))
+        {
+            std::cout << "Fault: truncated response\n";
+            size = std::uniform_int_distribution<size_t>(0, size - 1)(random);
+        }
+
+        write_all(master, response.data(), size);
+    }
+
+    static constexpr char usba[] = "USBA";
+
+    Options const options;
+    std::vector<unsigned char> memory;
+    std::vector<unsigned char> pending;
+    std::mt19937 random;
+    std::string slave_path;
+    int master = -1;
+    int slave = -1;
+};
+
+}
+
+int main(int argc, char * argv[])
+{
+    try
+    {
+        auto options = parse_options(argc, argv);
+        auto script = load_script(options.script);
+
+        std::signal(SIGINT, [](int) { running = 0; });
+        std::signal(SIGTERM, [](int) { running = 0; });
+
+        MockDevice device(std::move(options));
+        std::cout << "Mock device on " << device.path() << std::endl;
+        device.run(std::move(script));
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+}
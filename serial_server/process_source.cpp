@@ -0,0 +1,196 @@
+#include "process_source.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/uio.h>
+
+#include "logger.hpp"
+
+namespace
+{
+
+constexpr uint32_t wram_address = 0xf50000;
+constexpr uint32_t wram_size = 0x20000;
+
+std::vector<unsigned char> parse_hex(std::string const& hex)
+{
+    if (hex.size() % 2)
+    {
+        throw SourceConfigError("Signature must be an even number of hex digits");
+    }
+
+    std::vector<unsigned char> bytes;
+    for (size_t i = 0; i < hex.size(); i += 2)
+    {
+        bytes.push_back(static_cast<unsigned char>(std::stoul(hex.substr(i, 2), nullptr, 16)));
+    }
+    return bytes;
+}
+
+}
+
+ProcessSource::ProcessSource(pid_t pid, Locator locator)
+    : pid { pid }
+    , locator { std::move(locator) }
+{
+    if (!this->locator.base && this->locator.signature.empty())
+    {
+        throw SourceConfigError("Process source needs a base address or a signature");
+    }
+}
+
+std::string ProcessSource::describe() const
+{
+    return "pid:" + std::to_string(pid);
+}
+
+RegionData ProcessSource::read(std::vector<SramRegion> const& regions)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    auto const base = locate();
+
+    RegionData result(regions.size());
+    std::vector<iovec> local(regions.size());
+    std::vector<iovec> remote(regions.size());
+    size_t expected = 0;
+    for (size_t i = 0; i < regions.size(); ++i)
+    {
+        auto const& region = regions[i];
+        if (region.address < wram_address || region.address + region.size > wram_address + wram_size)
+        {
+            throw std::runtime_error("Process source can only read WRAM");
+        }
+
+        // The emulator writes straight into the buffers the snapshot keeps.
+        result[i].resize(region.size);
+        local[i] = iovec { result[i].data(), region.size };
+        remote[i] = iovec { reinterpret_cast<void *>(base + (region.address - wram_address)), region.size };
+        expected += region.size;
+    }
+
+    auto const read = ::process_vm_readv(pid, local.data(), local.size(), remote.data(), remote.size(), 0);
+    if (read < 0 || static_cast<size_t>(read) != expected)
+    {
+        // The emulator may have exited or reloaded, find WRAM again next time.
+        wram.reset();
+        throw std::runtime_error(std::string("process_vm_readv: ") + (read < 0 ? std::strerror(errno) : "short read"));
+    }
+
+    return result;
+}
+
+uintptr_t ProcessSource::locate()
+{
+    if (wram)
+    {
+        return *wram;
+    }
+
+    if (locator.base)
+    {
+        wram = locator.base;
+    }
+    else if (auto const match = scan())
+    {
+        wram = *match + locator.offset;
+        LOG_INFO << "Found WRAM of " << pid << " at " << as_hex(*wram);
+    }
+    else
+    {
+        throw std::runtime_error("Signature not found in process " + std::to_string(pid));
+    }
+
+    return *wram;
+}
+
+std::optional<uintptr_t> ProcessSource::scan()
+{
+    std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+    if (!maps)
+    {
+        throw std::runtime_error("No such process " + std::to_string(pid));
+    }
+
+    auto const& signature = locator.signature;
+    std::vector<unsigned char> chunk;
+    std::string line;
+    while (std::getline(maps, line))
+    {
+        std::istringstream is(line);
+        std::string range, permissions;
+        is >> range >> permissions;
+        if (permissions.size() < 2 || permissions[0] != 'r' || permissions[1] != 'w')
+        {
+            continue;
+        }
+
+        auto const dash = range.find('-');
+        auto const begin = static_cast<uintptr_t>(std::stoull(range.substr(0, dash), nullptr, 16));
+        auto const end = static_cast<uintptr_t>(std::stoull(range.substr(dash + 1), nullptr, 16));
+
+        // Read the mapping in chunks that overlap by the signature length.
+        static constexpr size_t chunk_size = 1 << 20;
+        for (auto address = begin; address < end; address += chunk_size)
+        {
+            auto const size = std::min<uintptr_t>(chunk_size + signature.size(), end - address);
+            chunk.resize(size);
+            iovec local { chunk.data(), size };
+            iovec remote { reinterpret_cast<void *>(address), size };
+            auto const read = ::process_vm_readv(pid, &local, 1, &remote, 1, 0);
+            if (read <= 0)
+            {
+                break;
+            }
+
+            auto const found = std::search(chunk.begin(), chunk.begin() + read, signature.begin(), signature.end());
+            if (found != chunk.begin() + read)
+            {
+                return address + (found - chunk.begin());
+            }
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::unique_ptr<MemorySource> make_process_source(std::string const& target)
+{
+    auto const question = target.find('?');
+    auto const pid = static_cast<pid_t>(std::stol(target.substr(0, question)));
+
+    ProcessSource::Locator locator;
+    if (question != std::string::npos)
+    {
+        std::istringstream is(target.substr(question + 1));
+        std::string option;
+        while (std::getline(is, option, '&'))
+        {
+            auto const equals = option.find('=');
+            auto const key = option.substr(0, equals);
+            auto const value = equals == std::string::npos ? std::string() : option.substr(equals + 1);
+            if (key == "base")
+            {
+                locator.base = static_cast<uintptr_t>(std::stoull(value, nullptr, 0));
+            }
+            else if (key == "signature")
+            {
+                locator.signature = parse_hex(value);
+            }
+            else if (key == "offset")
+            {
+                locator.offset = static_cast<intptr_t>(std::stoll(value, nullptr, 0));
+            }
+            else
+            {
+                throw SourceConfigError("Unknown process source option " + key);
+            }
+        }
+    }
+
+    return std::make_unique<ProcessSource>(pid, std::move(locator));
+}
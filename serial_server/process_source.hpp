@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "memory_source.hpp"
+
+/**
+ * Reads WRAM straight out of a local emulator process with process_vm_readv.
+ *
+ * The WRAM base in the emulator's address space is either given directly or
+ * found by scanning its writable mappings for a signature; base is then the
+ * match plus offset. Only the WRAM window 0xf50000-0xf6ffff can be read.
+ */
+class ProcessSource : public MemorySource
+{
+public:
+    struct Locator
+    {
+        std::optional<uintptr_t> base;
+        std::vector<unsigned char> signature;
+        intptr_t offset = 0;
+    };
+
+    ProcessSource(pid_t pid, Locator locator);
+
+    RegionData read(std::vector<SramRegion> const& regions) override;
+    std::string describe() const override;
+
+private:
+    uintptr_t locate();
+    std::optional<uintptr_t> scan();
+
+    pid_t const pid;
+    Locator const locator;
+
+    std::mutex mutex;
+    std::optional<uintptr_t> wram;
+};
+
+/**
+ * Parse "pid:<pid>?base=<address>" or "pid:<pid>?signature=<hex>&offset=<n>"
+ * (without the scheme).
+ */
+std::unique_ptr<MemorySource> make_process_source(std::string const& target);
@@ -0,0 +1,52 @@
+#include "read_plan.hpp"
+
+#include <algorithm>
+
+unsigned char SramData::byte_at(uint32_t address) const
+{
+    auto it = std::upper_bound(regions.begin(), regions.end(), address,
+            [](uint32_t address, SramRegion const& region) { return address < region.address; });
+    if (it == regions.begin())
+    {
+        return 0;
+    }
+    --it;
+
+    auto const& bytes = data[it - regions.begin()];
+    auto const offset = address - it->address;
+    return offset < bytes.size() ? bytes[offset] : 0;
+}
+
+std::vector<SramRegion> plan_reads(std::vector<Watch> const& watches, uint32_t gap_threshold, uint32_t max_region_size)
+{
+    std::vector<uint32_t> addresses;
+    addresses.reserve(watches.size());
+    for (auto const& watch : watches)
+    {
+        if (watch.mask)
+        {
+            addresses.push_back(watch.address);
+        }
+    }
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+    std::vector<SramRegion> regions;
+    for (auto const address : addresses)
+    {
+        if (!regions.empty())
+        {
+            auto & last = regions.back();
+            auto const end = last.address + last.size;
+            if (address - end <= gap_threshold && address + 1 - last.address <= max_region_size)
+            {
+                last.size = address + 1 - last.address;
+                continue;
+            }
+        }
+
+        regions.push_back(SramRegion { address, 1 });
+    }
+
+    return regions;
+}
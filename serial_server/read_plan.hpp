@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "super_metroid.hpp"
+
+/**
+ * A byte the server needs to look at, and the bits in it that matter.
+ */
+struct Watch
+{
+    uint32_t address;
+    unsigned char mask;
+};
+
+/**
+ * Bytes fetched for a plan, looked up by absolute SRAM address.
+ */
+struct SramData
+{
+    std::vector<SramRegion> regions;
+    std::vector<std::vector<unsigned char>> data;
+
+    /**
+     * Byte at address, 0 if no region covers it.
+     */
+    unsigned char byte_at(uint32_t address) const;
+};
+
+/**
+ * Merge the watched bytes into the fewest contiguous reads. Two neighbouring
+ * reads are bridged when at most gap_threshold unwatched bytes lie between
+ * them and the merged read stays within max_region_size bytes.
+ * The result is sorted by address.
+ */
+std::vector<SramRegion> plan_reads(std::vector<Watch> const& watches, uint32_t gap_threshold, uint32_t max_region_size = 255);
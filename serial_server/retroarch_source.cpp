@@ -0,0 +1,216 @@
+#include "retroarch_source.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr uint32_t wram_address = 0xf50000;
+constexpr uint32_t wram_size = 0x20000;
+constexpr uint32_t core_wram_address = 0x7e0000;
+
+// Replies spell every byte out as " xx", keep them well inside one datagram.
+constexpr uint32_t max_request_size = 256;
+
+// Where the bytes of one request go.
+struct Pending
+{
+    size_t region;
+    uint32_t offset;
+    uint32_t size;
+};
+
+}
+
+RetroArchSource::RetroArchSource(std::string host, std::string port, Command command, std::chrono::milliseconds timeout)
+    : host { std::move(host) }
+    , port { std::move(port) }
+    , command { command }
+    , timeout { timeout }
+{
+    connect();
+}
+
+RetroArchSource::~RetroArchSource()
+{
+    if (socket >= 0)
+    {
+        ::close(socket);
+    }
+}
+
+std::string RetroArchSource::describe() const
+{
+    return "retroarch:" + host + ":" + port;
+}
+
+void RetroArchSource::connect()
+{
+    addrinfo hints {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo * result = nullptr;
+    if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || !result)
+    {
+        throw std::runtime_error("RetroArch: could not resolve " + host);
+    }
+
+    socket = ::socket(result->ai_family, result->ai_socktype | SOCK_NONBLOCK, result->ai_protocol);
+    auto const connected = socket >= 0 && ::connect(socket, result->ai_addr, result->ai_addrlen) == 0;
+    auto const error = errno;
+    ::freeaddrinfo(result);
+    if (!connected)
+    {
+        // The destructor does not run for a constructor that throws.
+        if (socket >= 0)
+        {
+            ::close(socket);
+            socket = -1;
+        }
+        throw std::runtime_error(std::string("RetroArch: ") + std::strerror(error));
+    }
+}
+
+RegionData RetroArchSource::read(std::vector<SramRegion> const& regions)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+
+    char const* const name = command == Command::core_memory ? "READ_CORE_MEMORY" : "READ_CORE_RAM";
+    uint32_t const base = command == Command::core_memory ? core_wram_address : 0;
+
+    RegionData result(regions.size());
+    std::multimap<uint32_t, Pending> pending;
+    for (size_t i = 0; i < regions.size(); ++i)
+    {
+        auto const& region = regions[i];
+        if (region.address < wram_address || region.address + region.size > wram_address + wram_size)
+        {
+            throw std::runtime_error("RetroArch source can only read WRAM");
+        }
+
+        result[i].resize(region.size);
+        for (uint32_t offset = 0; offset < region.size; offset += max_request_size)
+        {
+            auto const address = base + region.address - wram_address + offset;
+            pending.emplace(address, Pending { i, offset, std::min(max_request_size, region.size - offset) });
+        }
+    }
+
+    // Late replies to an earlier, timed out read would be matched to this one.
+    char datagram[4096];
+    while (::recv(socket, datagram, sizeof(datagram), 0) > 0)
+    {
+    }
+
+    for (int attempt = 0; attempt < 2 && !pending.empty(); ++attempt)
+    {
+        for (auto const& [address, request] : pending)
+        {
+            char line[64];
+            auto const length = std::snprintf(line, sizeof(line), "%s %x %u\n", name, address, request.size);
+            ::send(socket, line, length, 0);
+        }
+
+        auto const deadline = std::chrono::steady_clock::now() + timeout;
+        while (!pending.empty())
+        {
+            auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            pollfd pfd { socket, POLLIN, 0 };
+            if (left <= 0 || ::poll(&pfd, 1, static_cast<int>(left)) <= 0)
+            {
+                break;
+            }
+
+            auto const received = ::recv(socket, datagram, sizeof(datagram) - 1, 0);
+            if (received <= 0)
+            {
+                continue;
+            }
+            datagram[received] = '\0';
+
+            std::istringstream is(datagram);
+            std::string reply;
+            uint32_t address;
+            if (!(is >> reply >> std::hex >> address) || reply != name)
+            {
+                continue;
+            }
+
+            auto const it = pending.find(address);
+            if (it == pending.end())
+            {
+                continue;
+            }
+
+            auto & bytes = result[it->second.region];
+            int value;
+            for (uint32_t i = 0; i < it->second.size; ++i)
+            {
+                if (!(is >> value) || value < 0)
+                {
+                    throw std::runtime_error(std::string("RetroArch: ") + name + " failed, is a game loaded?");
+                }
+                bytes[it->second.offset + i] = static_cast<unsigned char>(value);
+            }
+            pending.erase(it);
+        }
+    }
+
+    if (!pending.empty())
+    {
+        throw std::runtime_error("RetroArch: no reply from " + host + ":" + port);
+    }
+
+    return result;
+}
+
+std::unique_ptr<MemorySource> make_retroarch_source(std::string const& target)
+{
+    auto const question = target.find('?');
+    auto const address = target.substr(0, question);
+
+    auto const colon = address.rfind(':');
+    auto const host = colon == std::string::npos ? address : address.substr(0, colon);
+    auto const port = colon == std::string::npos ? std::string("55355") : address.substr(colon + 1);
+
+    auto command = RetroArchSource::Command::core_memory;
+    std::chrono::milliseconds timeout { 100 };
+    if (question != std::string::npos)
+    {
+        std::istringstream is(target.substr(question + 1));
+        std::string option;
+        while (std::getline(is, option, '&'))
+        {
+            auto const equals = option.find('=');
+            auto const key = option.substr(0, equals);
+            auto const value = equals == std::string::npos ? std::string() : option.substr(equals + 1);
+            if (key == "command" && (value == "memory" || value == "ram"))
+            {
+                command = value == "ram" ? RetroArchSource::Command::core_ram : RetroArchSource::Command::core_memory;
+            }
+            else if (key == "timeout")
+            {
+                timeout = std::chrono::milliseconds(std::stoul(value));
+            }
+            else
+            {
+                throw SourceConfigError("Unknown retroarch source option " + option);
+            }
+        }
+    }
+
+    return std::make_unique<RetroArchSource>(host, port, command, timeout);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "memory_source.hpp"
+
+/**
+ * Reads WRAM through RetroArch's UDP network command interface.
+ *
+ * Every region is sent as its own READ_CORE_MEMORY (system memory map,
+ * WRAM at 0x7e0000) or READ_CORE_RAM (offset into WRAM) datagram. All
+ * requests of a read go out back to back on one socket, and replies are
+ * matched to requests by the address they echo. Requests that are still
+ * unanswered at the timeout are resent once before the read fails.
+ */
+class RetroArchSource : public MemorySource
+{
+public:
+    enum class Command
+    {
+        core_memory,
+        core_ram
+    };
+
+    RetroArchSource(std::string host, std::string port, Command command, std::chrono::milliseconds timeout);
+    ~RetroArchSource();
+
+    RegionData read(std::vector<SramRegion> const& regions) override;
+    std::string describe() const override;
+
+private:
+    void connect();
+
+    std::string const host;
+    std::string const port;
+    Command const command;
+    std::chrono::milliseconds const timeout;
+
+    std::mutex mutex;
+    int socket = -1;
+};
+
+/**
+ * Parse "<host>[:port][?command=memory|ram&timeout=ms]" (without the scheme).
+ */
+std::unique_ptr<MemorySource> make_retroarch_source(std::string const& target);
@@ -0,0 +1,154 @@
+// Stand-in for RetroArch's UDP network command interface. Answers
+// READ_CORE_MEMORY and READ_CORE_RAM from a 128 KiB WRAM image, so the
+// retroarch: memory source can be used without an emulator:
+//
+//   retroarch_standin [--port 55355] [--script file] [--drop p]
+//
+// The script format is described in memory_script.hpp, addresses are in
+// the usb2snes space (WRAM at 0xf50000).
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "memory_script.hpp"
+
+namespace
+{
+
+constexpr uint32_t wram_address = 0xf50000;
+constexpr uint32_t core_wram_address = 0x7e0000;
+
+std::string answer(std::vector<unsigned char> const& wram, std::string const& request)
+{
+    std::istringstream is(request);
+    std::string command;
+    uint32_t address;
+    uint32_t size;
+    if (!(is >> command >> std::hex >> address >> std::dec >> size))
+    {
+        return {};
+    }
+
+    uint32_t offset;
+    if (command == "READ_CORE_MEMORY" && address >= core_wram_address)
+    {
+        offset = address - core_wram_address;
+    }
+    else if (command == "READ_CORE_RAM")
+    {
+        offset = address;
+    }
+    else if (command == "READ_CORE_MEMORY")
+    {
+        offset = static_cast<uint32_t>(wram.size());
+    }
+    else
+    {
+        return {};
+    }
+
+    char buffer[16];
+    std::snprintf(buffer, sizeof(buffer), " %x", address);
+    std::string reply = command + buffer;
+    if (offset + size > wram.size())
+    {
+        return reply + " -1 no memory at address\n";
+    }
+
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        std::snprintf(buffer, sizeof(buffer), " %02x", wram[offset + i]);
+        reply += buffer;
+    }
+    return reply + '\n';
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    uint16_t port = 55355;
+    std::string script;
+    double drop = 0;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string const key = argv[i];
+        if (key == "--port")
+        {
+            port = static_cast<uint16_t>(std::stoul(argv[i + 1]));
+        }
+        else if (key == "--script")
+        {
+            script = argv[i + 1];
+        }
+        else if (key == "--drop")
+        {
+            drop = std::stod(argv[i + 1]);
+        }
+    }
+
+    auto const fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in local {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0)
+    {
+        std::cerr << "Could not bind UDP port " << port << '\n';
+        return 1;
+    }
+    std::cout << "RetroArch stand-in on 127.0.0.1:" << port << std::endl;
+
+    std::vector<unsigned char> wram(0x20000);
+    ScriptPlayer player(load_script(script));
+    std::mt19937 random;
+
+    while (true)
+    {
+        player.apply_due([&wram](uint32_t address, std::vector<unsigned char> const& bytes)
+        {
+            for (size_t i = 0; i < bytes.size() && address - wram_address + i < wram.size(); ++i)
+            {
+                wram[address - wram_address + i] = bytes[i];
+            }
+            std::cout << "Script: " << std::hex << address << std::dec << std::endl;
+        });
+
+        pollfd pfd { fd, POLLIN, 0 };
+        if (::poll(&pfd, 1, player.next_timeout_ms()) <= 0)
+        {
+            continue;
+        }
+
+        char datagram[512];
+        sockaddr_storage peer {};
+        socklen_t peer_size = sizeof(peer);
+        auto const received = ::recvfrom(fd, datagram, sizeof(datagram) - 1, 0, reinterpret_cast<sockaddr *>(&peer), &peer_size);
+        if (received <= 0)
+        {
+            continue;
+        }
+        datagram[received] = '\0';
+
+        if (drop > 0 && std::uniform_real_distribution<>(0, 1)(random) < drop)
+        {
+            continue;
+        }
+
+        auto const reply = answer(wram, datagram);
+        if (!reply.empty())
+        {
+            ::sendto(fd, reply.data(), reply.size(), 0, reinterpret_cast<sockaddr *>(&peer), peer_size);
+        }
+    }
+}
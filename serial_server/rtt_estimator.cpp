@@ -0,0 +1,113 @@
+#include "rtt_estimator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+
+// Below this many samples a percentile says little.
+constexpr size_t min_samples = 16;
+
+std::chrono::milliseconds parse_ms(std::string const& key, std::string const& value)
+{
+    // stoul would wrap "-5" to a huge deadline.
+    size_t end = 0;
+    auto const ms = value.empty() || value[0] == '-' ? 0 : std::stoul(value, &end);
+    if (end == 0 || end != value.size() || ms > 3600000)
+    {
+        throw std::invalid_argument("Deadline " + key + " must be 0 to 3600000 ms, not '" + value + "'");
+    }
+    return std::chrono::milliseconds(ms);
+}
+
+}
+
+bool DeadlineConfig::set_option(std::string const& key, std::string const& value)
+{
+    if (key == "floor")
+    {
+        floor = parse_ms(key, value);
+    }
+    else if (key == "timeout")
+    {
+        ceiling = parse_ms(key, value);
+    }
+    else if (key == "factor")
+    {
+        size_t end = 0;
+        factor = std::stod(value, &end);
+        if (end != value.size() || !std::isfinite(factor))
+        {
+            throw std::invalid_argument("Deadline factor must be a number, not '" + value + "'");
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+void DeadlineConfig::validate() const
+{
+    if (floor > ceiling)
+    {
+        throw std::invalid_argument("Deadline floor " + std::to_string(floor.count()) + " ms is above the timeout of "
+                                    + std::to_string(ceiling.count()) + " ms");
+    }
+    if (!(factor > 0))
+    {
+        throw std::invalid_argument("Deadline factor must be positive, not " + std::to_string(factor));
+    }
+}
+
+RttEstimator::RttEstimator(DeadlineConfig config, size_t window)
+    : config { config }
+    , window { window }
+    , current { config.ceiling }
+{
+    samples.reserve(window);
+}
+
+void RttEstimator::record(std::chrono::steady_clock::duration rtt)
+{
+    if (samples.size() < window)
+    {
+        samples.push_back(rtt);
+    }
+    else
+    {
+        samples[next] = rtt;
+        next = (next + 1) % samples.size();
+    }
+
+    if (samples.size() < min_samples)
+    {
+        return;
+    }
+
+    auto sorted = samples;
+    auto const p99 = sorted.begin() + (sorted.size() * 99) / 100;
+    std::nth_element(sorted.begin(), p99, sorted.end());
+
+    auto const scaled = std::chrono::duration_cast<std::chrono::milliseconds>(*p99 * config.factor) + std::chrono::milliseconds(1);
+    current = std::clamp(scaled, config.floor, config.ceiling);
+}
+
+void RttEstimator::timed_out(std::chrono::milliseconds deadline)
+{
+    record(deadline);
+    current = std::clamp(std::max(current, deadline * 2), config.floor, config.ceiling);
+}
+
+std::chrono::milliseconds RttEstimator::deadline(int attempt) const
+{
+    auto result = current;
+    for (int i = 0; i < attempt && result < config.ceiling; ++i)
+    {
+        result *= 2;
+    }
+    return std::min(result, config.ceiling);
+}
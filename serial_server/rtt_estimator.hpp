@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct DeadlineConfig
+{
+    std::chrono::milliseconds floor { 20 };
+    std::chrono::milliseconds ceiling { 1000 };
+    double factor = 2;
+
+    /**
+     * Apply a "floor", "timeout" (the ceiling) or "factor" source option,
+     * false for any other key.
+     */
+    bool set_option(std::string const& key, std::string const& value);
+
+    /**
+     * Throws std::invalid_argument unless floor <= ceiling and factor > 0,
+     * call once all options are applied.
+     */
+    void validate() const;
+};
+
+/**
+ * Derives request deadlines from measured round trips: the p99 of a
+ * sliding window times a factor, clamped to [floor, ceiling]. Until the
+ * window has a few samples the ceiling is used. Each retry of a request
+ * doubles its deadline, up to the ceiling. Timeouts count as samples of
+ * the deadline they missed, so a device that slows down for good raises
+ * the deadline instead of failing every read. Not thread safe, owners call
+ * it under the lock that serialises their transactions.
+ */
+class RttEstimator
+{
+public:
+    explicit RttEstimator(DeadlineConfig config = {}, size_t window = 256);
+
+    void record(std::chrono::steady_clock::duration rtt);
+
+    /**
+     * An exchange missed deadline: the next one gets at least twice that.
+     */
+    void timed_out(std::chrono::milliseconds deadline);
+    std::chrono::milliseconds deadline(int attempt = 0) const;
+
+private:
+    DeadlineConfig const config;
+    size_t const window;
+    std::vector<std::chrono::steady_clock::duration> samples;
+    size_t next = 0;
+    std::chrono::milliseconds current;
+};
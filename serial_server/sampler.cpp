@@ -0,0 +1,115 @@
+#include "sampler.hpp"
+
+#include "logger.hpp"
+#include "span_trace.hpp"
+
+std::chrono::milliseconds Snapshot::age() const
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - timestamp);
+}
+
+Sampler::Sampler(std::string const& name, MemorySource & source, GameProfile const& profile, EventLog & events,
+                 std::vector<SramRegion> regions, std::chrono::milliseconds period,
+                 TraceRecorder * recorder)
+    : source { source }
+    , profile { profile }
+    , events { events }
+    , regions { std::move(regions) }
+    , period { period }
+    , recorder { recorder }
+    , name { name }
+    , jitter { MetricsRegistry::instance().histogram("sampler_jitter_milliseconds", "How late samples start against their schedule",
+                                                     exponential_buckets(0.125, 2, 14), { { "device", name } }) }
+    , sample_bytes { MetricsRegistry::instance().histogram("sampler_bytes_per_sample", "Bytes read from the device per sample",
+                                                           exponential_buckets(16, 2, 12), { { "device", name } }) }
+    , thread { [this] { run(); } }
+{}
+
+Sampler::~Sampler()
+{
+    running = false;
+    thread.join();
+}
+
+std::shared_ptr<Snapshot const> Sampler::latest() const
+{
+    return std::atomic_load(&snapshot);
+}
+
+std::shared_ptr<std::string const> Sampler::failure() const
+{
+    return std::atomic_load(&error);
+}
+
+void Sampler::run()
+{
+    SpanTracer::instance().name_thread("sampler " + name);
+    auto next = std::chrono::steady_clock::now();
+    while (running)
+    {
+        jitter.observe(std::chrono::steady_clock::now() - next);
+        sample();
+
+        next += period;
+        auto const now = std::chrono::steady_clock::now();
+        if (next < now)
+        {
+            // Fell behind (slow device or reconnect), do not try to catch up.
+            next = now;
+        }
+        std::this_thread::sleep_until(next);
+    }
+}
+
+void Sampler::sample()
+{
+    TraceIdScope trace { SpanTracer::new_id() };
+    Span span("sample");
+    try
+    {
+        auto const start = std::chrono::steady_clock::now();
+        auto data = source.read(regions);
+        size_t bytes = 0;
+        for (auto const& region : data)
+        {
+            bytes += region.size();
+        }
+        sample_bytes.observe(static_cast<double>(bytes));
+        // The bytes were latched somewhere inside the exchange, the midpoint is the best estimate.
+        auto const timestamp = start + (std::chrono::steady_clock::now() - start) / 2;
+
+        if (recorder)
+        {
+            recorder->record(timestamp, regions, data);
+        }
+
+        SramData sram { regions, std::move(data) };
+        auto const state = profile.evaluate(sram);
+
+        // The first sample is the baseline, not a transition.
+        auto const changed = sequence ? state ^ previous : WatchState {};
+        previous = state;
+
+        auto const taken = std::make_shared<Snapshot const>(Snapshot { ++sequence, timestamp, std::move(sram), state, SpanTracer::current_id() });
+        std::atomic_store(&snapshot, taken);
+        std::atomic_store(&error, std::shared_ptr<std::string const>());
+
+        for (size_t id = 0; id < profile.watches.size(); ++id)
+        {
+            if (changed[id])
+            {
+                events.record(timestamp, id, state[id]);
+            }
+        }
+    }
+    catch (std::exception const& e)
+    {
+        // An unplugged device fails every sample the same way, say it once.
+        auto const previous_error = failure();
+        if (!previous_error || *previous_error != e.what())
+        {
+            LOG_WARNING << "Sampler (" << source.describe() << "): " << e.what();
+        }
+        std::atomic_store(&error, std::make_shared<std::string const>(e.what()));
+    }
+}
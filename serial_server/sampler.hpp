@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "event_log.hpp"
+#include "game_profile.hpp"
+#include "metrics.hpp"
+#include "memory_source.hpp"
+#include "read_plan.hpp"
+#include "trace_file.hpp"
+#include "super_metroid.hpp"
+
+/**
+ * Immutable result of one sampling pass.
+ */
+struct Snapshot
+{
+    uint64_t sequence;
+    std::chrono::steady_clock::time_point timestamp;
+    SramData sram;
+    WatchState state;
+    // Trace of the sample, for linking the requests served from it.
+    uint64_t trace_id;
+
+    std::chrono::milliseconds age() const;
+};
+
+/**
+ * Polls the device from a dedicated thread, evaluates the profile once per
+ * sample and publishes the latest snapshot with an atomic pointer swap, so
+ * readers never touch the port. Watches that change between two samples
+ * are recorded in the event log with the time of the newer sample. With a
+ * recorder every sample is also appended to a trace. How late each sample
+ * starts and how many bytes it reads are kept as metrics, labelled with the
+ * device name. Each sample is a span of its own trace.
+ */
+class Sampler
+{
+public:
+    Sampler(std::string const& name, MemorySource & source, GameProfile const& profile, EventLog & events,
+            std::vector<SramRegion> regions, std::chrono::milliseconds period,
+            TraceRecorder * recorder = nullptr);
+    ~Sampler();
+
+    Sampler(Sampler const&) = delete;
+    Sampler & operator=(Sampler const&) = delete;
+
+    /**
+     * Latest published snapshot, nullptr until the first successful sample.
+     */
+    std::shared_ptr<Snapshot const> latest() const;
+
+    /**
+     * Why the last sample failed, nullptr while samples succeed. Routes use
+     * it to report the device as unavailable instead of serving stale state.
+     */
+    std::shared_ptr<std::string const> failure() const;
+
+private:
+    void run();
+    void sample();
+
+    MemorySource & source;
+    GameProfile const& profile;
+    EventLog & events;
+    std::vector<SramRegion> const regions;
+    std::chrono::milliseconds const period;
+    TraceRecorder * const recorder;
+    std::string const name;
+    Histogram & jitter;
+    Histogram & sample_bytes;
+
+    uint64_t sequence = 0;
+    WatchState previous;
+    std::shared_ptr<Snapshot const> snapshot;
+    std::shared_ptr<std::string const> error;
+    std::atomic<bool> running { true };
+    std::thread thread;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <exception>
+#include <future>
+#include <map>
+#include <mutex>
+
+/**
+ * Deduplicates concurrent calls for the same key. The first caller runs the
+ * work, callers arriving while it is in flight block on the same result
+ * (or exception) instead of starting their own.
+ */
+template<typename Key, typename Value>
+class SingleFlight
+{
+public:
+    template<typename F>
+    Value run(Key const& key, F && f)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto const it = in_flight.find(key);
+        if (it != in_flight.end())
+        {
+            auto const shared = it->second;
+            lock.unlock();
+            return shared.get();
+        }
+
+        std::promise<Value> promise;
+        in_flight.emplace(key, promise.get_future().share());
+        lock.unlock();
+
+        try
+        {
+            Value value = f();
+            finish(key);
+            promise.set_value(value);
+            return value;
+        }
+        catch (...)
+        {
+            finish(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+private:
+    void finish(Key const& key)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        in_flight.erase(key);
+    }
+
+    std::mutex mutex;
+    std::map<Key, std::shared_future<Value>> in_flight;
+};
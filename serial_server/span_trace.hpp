@@ -0,0 +1,335 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+/**
+ * Span tracing for finding out where the latency of one split goes, from
+ * the timer's poll through HTTP to the serial exchange. Header only, both
+ * the timer and serial_server use it.
+ *
+ * Spans are written as Chrome trace events, which chrome://tracing and
+ * ui.perfetto.dev load. Times are wall clock microseconds, so the events of
+ * both processes line up on one timeline. Spans of one operation share a
+ * trace id, the client sends it in the X-Trace-Id header as hex. A span
+ * can also name one other trace it depends on, such as the sample whose
+ * data a request served; viewers show it as the linked_trace_id argument.
+ *
+ * While tracing is disabled a span costs one relaxed load. Threads record
+ * into their own bounded ring, keeping the newest events; rings of exited
+ * threads are handed to new ones, so thread-per-connection servers do not
+ * grow them without bound.
+ */
+class SpanTracer
+{
+public:
+    static constexpr char const* header = "X-Trace-Id";
+    static constexpr size_t ring_capacity = 16384;
+
+    static SpanTracer & instance()
+    {
+        static SpanTracer tracer;
+        return tracer;
+    }
+
+    static bool enabled()
+    {
+        return instance().active.load(std::memory_order_relaxed);
+    }
+
+    static void enable(bool on = true)
+    {
+        instance().active.store(on, std::memory_order_relaxed);
+    }
+
+    static int64_t now_us()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t new_id()
+    {
+        thread_local std::mt19937_64 random { std::random_device {}() };
+        uint64_t id = 0;
+        while (id == 0)
+        {
+            id = random();
+        }
+        return id;
+    }
+
+    /**
+     * Trace id of what the calling thread is working on, 0 for none.
+     */
+    static uint64_t & current_id()
+    {
+        thread_local uint64_t id = 0;
+        return id;
+    }
+
+    /**
+     * Trace the innermost open span of the calling thread depends on, 0 for
+     * none. Span picks it up when it ends.
+     */
+    static uint64_t & linked_id()
+    {
+        thread_local uint64_t id = 0;
+        return id;
+    }
+
+    static void link(uint64_t id)
+    {
+        linked_id() = id;
+    }
+
+    static std::string format_id(uint64_t id)
+    {
+        char text[17];
+        std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(id));
+        return text;
+    }
+
+    static uint64_t parse_id(std::string const& text)
+    {
+        return std::strtoull(text.c_str(), nullptr, 16);
+    }
+
+    void record(std::string name, uint64_t id, int64_t start_us, int64_t end_us, uint64_t linked = 0)
+    {
+        auto & holder = local();
+        std::lock_guard<std::mutex> guard(holder.ring->mutex);
+        holder.ring->push(Event { std::move(name), id, start_us, end_us - start_us, holder.tid, linked });
+    }
+
+    /**
+     * Shown as the calling thread's name in the viewer.
+     */
+    void name_thread(std::string name)
+    {
+        auto & holder = local();
+        std::lock_guard<std::mutex> guard(mutex);
+        thread_names.emplace_back(holder.tid, std::move(name));
+    }
+
+    /**
+     * The recorded events as a JSON array, without the enclosing document.
+     */
+    std::string events_json() const
+    {
+        std::vector<Event> events;
+        std::vector<std::pair<uint32_t, std::string>> names;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            names = thread_names;
+            for (auto const& ring : rings)
+            {
+                std::lock_guard<std::mutex> ring_guard(ring->mutex);
+                ring->copy_to(events);
+            }
+        }
+        std::sort(events.begin(), events.end(), [](Event const& a, Event const& b) { return a.start_us < b.start_us; });
+
+        auto const pid = std::to_string(::getpid());
+        std::string json = "[";
+        for (auto const& [tid, name] : names)
+        {
+            json += json.size() > 1 ? ",\n" : "\n";
+            json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + std::to_string(tid)
+                  + ",\"args\":{\"name\":" + quote(name) + "}}";
+        }
+        for (auto const& event : events)
+        {
+            json += json.size() > 1 ? ",\n" : "\n";
+            json += "{\"name\":" + quote(event.name) + ",\"cat\":\"split\",\"ph\":\"X\",\"ts\":" + std::to_string(event.start_us)
+                  + ",\"dur\":" + std::to_string(event.duration_us) + ",\"pid\":" + pid + ",\"tid\":" + std::to_string(event.tid)
+                  + ",\"args\":{\"trace_id\":\"" + format_id(event.id) + '"'
+                  + (event.linked ? ",\"linked_trace_id\":\"" + format_id(event.linked) + '"' : std::string()) + "}}";
+        }
+        json += "\n]";
+        return json;
+    }
+
+    /**
+     * A complete trace document; more_events is a JSON array of events from
+     * elsewhere, such as the server's, to merge in.
+     */
+    std::string chrome_json(std::string const& more_events = "[]") const
+    {
+        auto events = events_json();
+        auto const open = more_events.find('[');
+        auto const close = more_events.rfind(']');
+        if (open != std::string::npos && close != std::string::npos
+            && more_events.find_first_not_of(" \t\r\n", open + 1) != close)
+        {
+            events.pop_back();
+            events += (events.size() > 2 ? "," : "") + more_events.substr(open + 1, close - open - 1) + ']';
+        }
+        return "{\"displayTimeUnit\":\"ms\",\"traceEvents\":" + events + "}\n";
+    }
+
+    SpanTracer(SpanTracer const&) = delete;
+    SpanTracer & operator=(SpanTracer const&) = delete;
+
+private:
+    struct Event
+    {
+        std::string name;
+        uint64_t id;
+        int64_t start_us;
+        int64_t duration_us;
+        uint32_t tid;
+        uint64_t linked;
+    };
+
+    struct Ring
+    {
+        std::mutex mutex;
+        std::vector<Event> events;
+        size_t next = 0;
+
+        void push(Event event)
+        {
+            if (events.size() < ring_capacity)
+            {
+                events.push_back(std::move(event));
+                return;
+            }
+            events[next] = std::move(event);
+            next = (next + 1) % ring_capacity;
+        }
+
+        void copy_to(std::vector<Event> & out) const
+        {
+            out.insert(out.end(), events.begin(), events.end());
+        }
+    };
+
+    // Borrows a ring for the lifetime of a thread.
+    struct Holder
+    {
+        Ring * ring;
+        uint32_t tid;
+
+        ~Holder()
+        {
+            auto & tracer = instance();
+            std::lock_guard<std::mutex> guard(tracer.mutex);
+            tracer.spare.push_back(ring);
+        }
+    };
+
+    SpanTracer() = default;
+
+    Holder & local()
+    {
+        thread_local Holder holder = [this]
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (spare.empty())
+            {
+                rings.push_back(std::make_unique<Ring>());
+                spare.push_back(rings.back().get());
+            }
+            auto const ring = spare.back();
+            spare.pop_back();
+            return Holder { ring, next_tid++ };
+        }();
+        return holder;
+    }
+
+    static std::string quote(std::string const& text)
+    {
+        std::string quoted = "\"";
+        for (auto const c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                quoted += '\\';
+            }
+            if (static_cast<unsigned char>(c) >= 0x20)
+            {
+                quoted += c;
+            }
+        }
+        return quoted + '"';
+    }
+
+    std::atomic<bool> active { false };
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::vector<Ring *> spare;
+    std::vector<std::pair<uint32_t, std::string>> thread_names;
+    uint32_t next_tid = 1;
+};
+
+/**
+ * Records the enclosing scope as a span of the current trace.
+ */
+class Span
+{
+public:
+    explicit Span(std::string_view name)
+        : start_us { SpanTracer::enabled() ? SpanTracer::now_us() : 0 }
+        , outer_link { start_us ? std::exchange(SpanTracer::linked_id(), 0) : 0 }
+    {
+        if (start_us)
+        {
+            this->name = name;
+        }
+    }
+
+    ~Span()
+    {
+        if (start_us)
+        {
+            SpanTracer::instance().record(std::move(name), SpanTracer::current_id(), start_us, SpanTracer::now_us(),
+                                          SpanTracer::linked_id());
+            SpanTracer::linked_id() = outer_link;
+        }
+    }
+
+    Span(Span const&) = delete;
+    Span & operator=(Span const&) = delete;
+
+private:
+    int64_t const start_us;
+    uint64_t const outer_link;
+    std::string name;
+};
+
+/**
+ * Makes id the calling thread's trace id until the end of the scope.
+ */
+class TraceIdScope
+{
+public:
+    explicit TraceIdScope(uint64_t id)
+        : previous { SpanTracer::current_id() }
+    {
+        SpanTracer::current_id() = id;
+    }
+
+    ~TraceIdScope()
+    {
+        SpanTracer::current_id() = previous;
+    }
+
+    TraceIdScope(TraceIdScope const&) = delete;
+    TraceIdScope & operator=(TraceIdScope const&) = delete;
+
+private:
+    uint64_t const previous;
+};
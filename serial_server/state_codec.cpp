@@ -0,0 +1,230 @@
+#include "state_codec.hpp"
+
+#include <charconv>
+
+#include "json11.hpp"
+#include "state_frame.hpp"
+
+namespace
+{
+
+template<typename T>
+void append_number(std::string & out, T value)
+{
+    char buffer[24];
+    auto const result = std::to_chars(std::begin(buffer), std::end(buffer), value);
+    out.append(buffer, result.ptr);
+}
+
+void append_age(std::string & out, std::chrono::milliseconds age)
+{
+    out += "\"age_ms\":";
+    append_number(out, age.count());
+}
+
+}
+
+void append_state_members(std::string & out, GameProfile const& profile, WatchState const& state)
+{
+    out += '{';
+    for (size_t id = 0; id < profile.watches.size(); ++id)
+    {
+        if (id)
+        {
+            out += ',';
+        }
+        out += profile.json_keys[id];
+        out += state[id] ? "true" : "false";
+    }
+}
+
+std::string state_to_json(GameProfile const& profile, WatchState const& state, std::chrono::milliseconds age)
+{
+    std::string out;
+    // Every member is at most its key and "false,", plus room for age_ms.
+    size_t size = 64;
+    for (auto const& key : profile.json_keys)
+    {
+        size += key.size() + 6;
+    }
+    out.reserve(size);
+
+    append_state_members(out, profile, state);
+    out += profile.watches.empty() ? "" : ",";
+    append_age(out, age);
+    out += '}';
+    return out;
+}
+
+std::string state_to_frame(GameProfile const& profile, uint64_t sequence, std::chrono::steady_clock::time_point timestamp,
+                           WatchState const& state, std::chrono::milliseconds age)
+{
+    using namespace std::chrono;
+
+    StateFrame frame;
+    frame.schema = profile.schema;
+    frame.sequence = sequence;
+    frame.timestamp_us = static_cast<uint64_t>(duration_cast<microseconds>(timestamp.time_since_epoch()).count());
+    frame.age_ms = static_cast<uint32_t>(age.count());
+    frame.values.resize(profile.watches.size());
+    for (size_t id = 0; id < profile.watches.size(); ++id)
+    {
+        frame.values[id] = state[id];
+    }
+    return frame.encode();
+}
+
+std::string schema_to_json(GameProfile const& profile)
+{
+    json11::Json::array watches;
+    for (size_t id = 0; id < profile.watches.size(); ++id)
+    {
+        watches.push_back(json11::Json::object {
+            { "id", static_cast<int>(id) },
+            { "key", profile.keys[id] },
+            { "name", profile.names[id] },
+        });
+    }
+
+    auto const watch_id = [](std::optional<size_t> id) { return id ? json11::Json(static_cast<int>(*id)) : json11::Json(); };
+    return json11::Json(json11::Json::object {
+        { "schema", static_cast<double>(profile.schema) },
+        { "profile", profile.name },
+        { "watches", watches },
+        { "start", watch_id(profile.start_watch) },
+        { "end", watch_id(profile.end_watch) },
+    }).dump();
+}
+
+std::string flag_to_json(char const* key, bool value, std::chrono::milliseconds age)
+{
+    std::string out;
+    out.reserve(64);
+    out += "{\"";
+    out += key;
+    out += "\":";
+    out += value ? "true," : "false,";
+    append_age(out, age);
+    out += '}';
+    return out;
+}
+
+void append_event(std::string & out, GameProfile const& profile, WatchEvent const& event, std::chrono::steady_clock::time_point now)
+{
+    using namespace std::chrono;
+
+    out += "{\"seq\":";
+    append_number(out, event.sequence);
+    out += ",\"id\":";
+    append_number(out, event.watch);
+    out += ",\"key\":";
+    auto const& key = profile.json_keys[event.watch];
+    out.append(key, 0, key.size() - 1);
+    out += ",\"value\":";
+    out += event.value ? "true" : "false";
+    out += ",\"t_us\":";
+    append_number(out, duration_cast<microseconds>(event.timestamp.time_since_epoch()).count());
+    out += ',';
+    append_age(out, duration_cast<milliseconds>(now - event.timestamp));
+    out += '}';
+}
+
+std::string events_to_json(GameProfile const& profile, std::vector<WatchEvent> const& events, uint64_t last_sequence)
+{
+    auto const now = std::chrono::steady_clock::now();
+
+    std::string out;
+    out.reserve(32 + events.size() * 96);
+    out += "{\"events\":[";
+    for (auto const& event : events)
+    {
+        if (&event != &events.front())
+        {
+            out += ',';
+        }
+        append_event(out, profile, event, now);
+    }
+    out += "],\"last\":";
+    append_number(out, last_sequence);
+    out += '}';
+    return out;
+}
+
+std::string events_lost_to_json(uint64_t last_sequence)
+{
+    std::string out = "{\"error\":\"events lost\",\"last\":";
+    append_number(out, last_sequence);
+    out += '}';
+    return out;
+}
+
+std::string event_to_frame(GameProfile const& profile, WatchEvent const& event)
+{
+    std::string out;
+    out.reserve(96);
+    append_event(out, profile, event, std::chrono::steady_clock::now());
+    return out;
+}
+
+std::string subscription_to_frame(GameProfile const& profile, WatchState const& subscribed, WatchState const* state,
+                                  std::chrono::milliseconds age)
+{
+    std::string out = "{\"state\":{";
+    bool first = true;
+    for (size_t id = 0; id < profile.watches.size(); ++id)
+    {
+        if (subscribed[id])
+        {
+            out += first ? "" : ",";
+            out += profile.json_keys[id];
+            out += !state ? "null" : (*state)[id] ? "true" : "false";
+            first = false;
+        }
+    }
+    out += '}';
+    if (state)
+    {
+        out += ',';
+        append_age(out, age);
+    }
+    out += '}';
+    return out;
+}
+
+std::string events_to_sse(GameProfile const& profile, std::vector<WatchEvent> const& events)
+{
+    auto const now = std::chrono::steady_clock::now();
+
+    std::string out;
+    out.reserve(events.size() * 128);
+    for (auto const& event : events)
+    {
+        out += "id: ";
+        append_number(out, event.sequence);
+        out += "\nevent: ";
+        if (event.value && profile.start_watch == event.watch)
+        {
+            out += "start";
+        }
+        else if (event.value && profile.end_watch == event.watch)
+        {
+            out += "end";
+        }
+        else
+        {
+            out += "watch";
+        }
+        out += "\ndata: ";
+        append_event(out, profile, event, now);
+        out += "\n\n";
+    }
+    return out;
+}
+
+std::string events_lost_to_sse(uint64_t sequence)
+{
+    std::string out = "id: ";
+    append_number(out, sequence);
+    out += "\nevent: reset\ndata: {}\n\n";
+    return out;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "event_log.hpp"
+#include "game_profile.hpp"
+
+/**
+ * Append the state as a JSON object of key: bool members, without the
+ * closing brace so callers can add fields of their own.
+ */
+void append_state_members(std::string & out, GameProfile const& profile, WatchState const& state);
+
+/**
+ * Body for /state: every watch plus age_ms, built in one buffer.
+ */
+std::string state_to_json(GameProfile const& profile, WatchState const& state, std::chrono::milliseconds age);
+
+/**
+ * Binary body for /state, see StateFrame.
+ */
+std::string state_to_frame(GameProfile const& profile, uint64_t sequence, std::chrono::steady_clock::time_point timestamp,
+                           WatchState const& state, std::chrono::milliseconds age);
+
+/**
+ * Body for /schema: the profile's watch ids, keys and names, and the schema
+ * value binary states carry.
+ */
+std::string schema_to_json(GameProfile const& profile);
+
+/**
+ * Body for single flag routes such as /game_started: {"<key>":bool,"age_ms":n}
+ */
+std::string flag_to_json(char const* key, bool value, std::chrono::milliseconds age);
+
+/**
+ * Body for /event_log: the events oldest first and the newest sequence
+ * number, to pass as since in the next request. Each event carries its
+ * monotonic sample time (t_us) and how long ago that was (age_ms).
+ */
+std::string events_to_json(GameProfile const& profile, std::vector<WatchEvent> const& events, uint64_t last_sequence);
+
+/**
+ * Body for /event_log when events after the client's cursor were dropped:
+ * {"error":"events lost","last":n}. The client resyncs from /state and
+ * continues with since=n.
+ */
+std::string events_lost_to_json(uint64_t last_sequence);
+
+/**
+ * Server-Sent Events frames for /events. The event id is the sequence
+ * number, so clients resume with Last-Event-ID. The event type is start or
+ * end when the profile's start or end watch becomes set, watch otherwise.
+ */
+std::string events_to_sse(GameProfile const& profile, std::vector<WatchEvent> const& events);
+
+/**
+ * Server-Sent Events frame telling an /events client that events after
+ * its Last-Event-ID were dropped and it has to resync from /state: a reset
+ * event whose id is the sequence the following events continue from.
+ */
+std::string events_lost_to_sse(uint64_t sequence);
+
+/**
+ * WebSocket frame for one event, the same object as in /event_log.
+ */
+std::string event_to_frame(GameProfile const& profile, WatchEvent const& event);
+
+/**
+ * WebSocket frame answering a subscription: the subscribed watches' values
+ * in the latest snapshot, {"state":{"<key>":bool,...},"age_ms":n}. Before
+ * the first snapshot the values are null and there is no age_ms.
+ */
+std::string subscription_to_frame(GameProfile const& profile, WatchState const& subscribed, WatchState const* state,
+                                  std::chrono::milliseconds age);
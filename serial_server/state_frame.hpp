@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "json11.hpp"
+
+/**
+ * Binary /state body, for clients that send Accept: application/x-watch-state.
+ * Header only, the timer decodes it too. All numbers little endian:
+ *
+ *   0  u8   version (1)
+ *   1  u8   reserved (0)
+ *   2  u16  watch count
+ *   4  u32  schema, see schema_hash
+ *   8  u64  snapshot sequence number
+ *  16  u64  sample time, monotonic microseconds (t_us in /event_log)
+ *  24  u32  snapshot age in milliseconds
+ *  28       watch values, one bit per watch id: id / 8 is the byte, id % 8 the bit
+ *
+ * /schema maps the ids to keys and names. A client keeps the schema until a
+ * frame carries a different one.
+ */
+struct StateFrame
+{
+    static constexpr char const* content_type = "application/x-watch-state";
+    static constexpr uint8_t version = 1;
+    static constexpr size_t header_size = 28;
+
+    uint32_t schema = 0;
+    uint64_t sequence = 0;
+    uint64_t timestamp_us = 0;
+    uint32_t age_ms = 0;
+    std::vector<bool> values;
+
+    std::string encode() const
+    {
+        std::string out(header_size + (values.size() + 7) / 8, '\0');
+        out[0] = static_cast<char>(version);
+        put(out, 2, values.size(), 2);
+        put(out, 4, schema, 4);
+        put(out, 8, sequence, 8);
+        put(out, 16, timestamp_us, 8);
+        put(out, 24, age_ms, 4);
+        for (size_t id = 0; id < values.size(); ++id)
+        {
+            if (values[id])
+            {
+                out[header_size + id / 8] = static_cast<char>(out[header_size + id / 8] | (1 << (id % 8)));
+            }
+        }
+        return out;
+    }
+
+    static StateFrame decode(std::string const& body)
+    {
+        if (body.size() < header_size || static_cast<uint8_t>(body[0]) != version)
+        {
+            throw std::runtime_error("State frame: unknown version or truncated");
+        }
+
+        StateFrame frame;
+        auto const count = static_cast<size_t>(get(body, 2, 2));
+        if (body.size() < header_size + (count + 7) / 8)
+        {
+            throw std::runtime_error("State frame: truncated");
+        }
+        frame.schema = static_cast<uint32_t>(get(body, 4, 4));
+        frame.sequence = get(body, 8, 8);
+        frame.timestamp_us = get(body, 16, 8);
+        frame.age_ms = static_cast<uint32_t>(get(body, 24, 4));
+        frame.values.resize(count);
+        for (size_t id = 0; id < count; ++id)
+        {
+            frame.values[id] = (static_cast<uint8_t>(body[header_size + id / 8]) >> (id % 8)) & 1;
+        }
+        return frame;
+    }
+
+private:
+    static void put(std::string & out, size_t offset, uint64_t value, size_t bytes)
+    {
+        for (size_t i = 0; i < bytes; ++i)
+        {
+            out[offset + i] = static_cast<char>(value >> (8 * i));
+        }
+    }
+
+    static uint64_t get(std::string const& in, size_t offset, size_t bytes)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; ++i)
+        {
+            value |= uint64_t(static_cast<uint8_t>(in[offset + i])) << (8 * i);
+        }
+        return value;
+    }
+};
+
+/**
+ * Identifies a list of watch keys: FNV-1a over the keys, each followed by a
+ * zero byte. Frames and schemas of the same profile carry the same value.
+ */
+inline uint32_t schema_hash(std::vector<std::string> const& keys)
+{
+    uint32_t hash = 2166136261u;
+    auto const add = [&hash](unsigned char c)
+    {
+        hash = (hash ^ c) * 16777619u;
+    };
+    for (auto const& key : keys)
+    {
+        for (auto const c : key)
+        {
+            add(static_cast<unsigned char>(c));
+        }
+        add(0);
+    }
+    return hash;
+}
+
+/**
+ * Client side of /schema: {"schema":n,"profile":"...","watches":[{"id":0,"key":"...","name":"..."},...]}.
+ */
+struct StateSchema
+{
+    uint32_t id = 0;
+    std::vector<std::string> keys;
+
+    std::optional<size_t> find(std::string const& key) const
+    {
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            if (keys[i] == key)
+            {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    static StateSchema parse(std::string const& body)
+    {
+        std::string err;
+        auto const jsn = json11::Json::parse(body, err);
+        if (!err.empty())
+        {
+            throw std::runtime_error("Schema: " + err);
+        }
+
+        StateSchema schema;
+        schema.id = static_cast<uint32_t>(jsn["schema"].number_value());
+        for (auto const& watch : jsn["watches"].array_items())
+        {
+            auto const id = static_cast<size_t>(watch["id"].int_value());
+            if (id >= schema.keys.size())
+            {
+                schema.keys.resize(id + 1);
+            }
+            schema.keys[id] = watch["key"].string_value();
+        }
+        return schema;
+    }
+};
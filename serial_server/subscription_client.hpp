@@ -0,0 +1,198 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+
+#include "json11.hpp"
+
+/**
+ * Timer side of SubscriptionServer: follows one watch at a time and waits
+ * for it to become set. Header only, for the timer.
+ *
+ * Frames of a previously followed watch can still arrive after follow.
+ * Until the reply to the newest subscription is in nothing counts, that
+ * reply names the watches it covers (start and end resolved to their
+ * keys), and frames of any other watch are ignored. Errors throw
+ * std::runtime_error, close() before trying again.
+ */
+class WatchSubscription
+{
+public:
+    WatchSubscription(std::string host, int port, std::string path = "/")
+        : host { std::move(host) }
+        , port { std::to_string(port) }
+        , path { std::move(path) }
+    {}
+
+    /**
+     * Follow key from now on, connecting first if needed. Returns at once,
+     * the reply is handled by wait.
+     */
+    void follow(std::string const& key)
+    {
+        if (!ws)
+        {
+            connect();
+        }
+        if (key == followed)
+        {
+            return;
+        }
+
+        auto const request = json11::Json(json11::Json::object { { "subscribe", json11::Json::array { key } } }).dump();
+        ws->text(true);
+        run("subscribe", [this, &request](auto handler) { ws->async_write(boost::asio::buffer(request), handler); });
+        followed = key;
+        watching.clear();
+        ++pending;
+    }
+
+    /**
+     * Wait up to timeout for the followed watch to be set. Returns how long
+     * before now the server saw it set, nullopt if it was not.
+     */
+    std::optional<std::chrono::milliseconds> wait(std::chrono::milliseconds timeout)
+    {
+        auto const deadline = std::chrono::steady_clock::now() + timeout;
+        while (true)
+        {
+            if (!reading)
+            {
+                reading = true;
+                received = false;
+                buffer.clear();
+                ws->async_read(buffer, [this](boost::beast::error_code const& e, size_t)
+                {
+                    error = e;
+                    received = true;
+                });
+            }
+
+            io.restart();
+            while (!received && io.run_one_until(deadline))
+            {
+            }
+            if (!received)
+            {
+                return std::nullopt;
+            }
+
+            reading = false;
+            if (error)
+            {
+                throw std::runtime_error("Subscription: " + error.message());
+            }
+            if (auto const age = handle(boost::beast::buffers_to_string(buffer.data())))
+            {
+                return age;
+            }
+        }
+    }
+
+    void close()
+    {
+        if (ws)
+        {
+            // Let a pending read finish as aborted before the stream goes.
+            boost::beast::get_lowest_layer(*ws).close();
+            io.restart();
+            io.run();
+            ws.reset();
+        }
+        io.restart();
+        reading = false;
+        pending = 0;
+        followed.clear();
+        watching.clear();
+    }
+
+private:
+    // Runs one async operation to completion; a read pending meanwhile may complete too.
+    template <typename Start>
+    void run(char const* what, Start && start)
+    {
+        boost::beast::error_code result;
+        bool done = false;
+        start([&result, &done](boost::beast::error_code e, auto &&...)
+        {
+            result = e;
+            done = true;
+        });
+        io.restart();
+        while (!done && io.run_one())
+        {
+        }
+        if (result)
+        {
+            throw std::runtime_error(std::string("Subscription: ") + what + ": " + result.message());
+        }
+    }
+
+    void connect()
+    {
+        ws = std::make_unique<boost::beast::websocket::stream<boost::beast::tcp_stream>>(io);
+        auto & stream = boost::beast::get_lowest_layer(*ws);
+        boost::asio::ip::tcp::resolver resolver(io);
+        auto const endpoints = resolver.resolve(host, port);
+        stream.expires_after(std::chrono::seconds(2));
+        run("connect", [&stream, &endpoints](auto handler) { stream.async_connect(endpoints, handler); });
+        run("handshake", [this](auto handler) { ws->async_handshake(host + ":" + port, path, handler); });
+        stream.expires_never();
+    }
+
+    std::optional<std::chrono::milliseconds> handle(std::string const& frame)
+    {
+        std::string parse_error;
+        auto const jsn = json11::Json::parse(frame, parse_error);
+        if (!parse_error.empty() || jsn["error"].is_string())
+        {
+            throw std::runtime_error("Subscription: " + (parse_error.empty() ? jsn["error"].string_value() : parse_error));
+        }
+
+        auto const age = std::chrono::milliseconds(jsn["age_ms"].int_value());
+        if (jsn.object_items().count("state") && --pending > 0)
+        {
+            return std::nullopt;
+        }
+        if (jsn["state"].is_object())
+        {
+            watching.clear();
+            bool set = false;
+            for (auto const& [key, value] : jsn["state"].object_items())
+            {
+                watching.insert(key);
+                set = set || value.bool_value();
+            }
+            return set ? std::optional(age) : std::nullopt;
+        }
+
+        if (watching.count(jsn["key"].string_value()) && jsn["value"].bool_value())
+        {
+            return age;
+        }
+        return std::nullopt;
+    }
+
+    std::string const host;
+    std::string const port;
+    std::string const path;
+
+    boost::asio::io_context io;
+    std::unique_ptr<boost::beast::websocket::stream<boost::beast::tcp_stream>> ws;
+    boost::beast::flat_buffer buffer;
+    boost::beast::error_code error;
+    bool reading = false;
+    bool received = false;
+    int pending = 0;
+    std::string followed;
+    std::set<std::string> watching;
+};
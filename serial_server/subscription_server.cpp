@@ -0,0 +1,292 @@
+#include "subscription_server.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/websocket.hpp>
+
+#include "json11.hpp"
+#include "logger.hpp"
+#include "span_trace.hpp"
+#include "state_codec.hpp"
+
+namespace beast = boost::beast;
+namespace asio = boost::asio;
+namespace http = beast::http;
+namespace websocket = beast::websocket;
+using tcp = asio::ip::tcp;
+
+namespace
+{
+
+// Frames a client may fall behind by before it is dropped.
+constexpr size_t max_queued = 1024;
+
+class Session : public std::enable_shared_from_this<Session>
+{
+public:
+    Session(tcp::socket socket, Devices const& devices)
+        : ws { std::move(socket) }
+        , devices { devices }
+    {}
+
+    void start()
+    {
+        beast::get_lowest_layer(ws).expires_after(std::chrono::seconds(10));
+        http::async_read(beast::get_lowest_layer(ws), buffer, request,
+                         [self = shared_from_this()](beast::error_code const& error, size_t) { self->upgrade(error); });
+    }
+
+    void deliver(Device const& from, std::vector<WatchEvent> const& events)
+    {
+        if (device != &from || !open)
+        {
+            return;
+        }
+
+        for (auto const& event : events)
+        {
+            if (subscribed[event.watch])
+            {
+                send(event_to_frame(device->profile, event));
+            }
+        }
+    }
+
+private:
+    void upgrade(beast::error_code const& error)
+    {
+        if (error || !websocket::is_upgrade(request))
+        {
+            return;
+        }
+
+        std::string const target(request.target());
+        std::string const prefix = "/devices/";
+        for (auto const& candidate : devices)
+        {
+            if (target == "/" ? candidate == devices.front() : target == prefix + candidate->name)
+            {
+                device = candidate.get();
+            }
+        }
+
+        // The stream's own keep-alive pings take over from the handshake deadline.
+        beast::get_lowest_layer(ws).expires_never();
+        ws.set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+        ws.async_accept(request, [self = shared_from_this(), target](beast::error_code const& error)
+        {
+            if (error)
+            {
+                return;
+            }
+            self->open = true;
+            if (!self->device)
+            {
+                self->send(json11::Json(json11::Json::object { { "error", "no device at " + target } }).dump());
+            }
+            self->receive();
+        });
+    }
+
+    void receive()
+    {
+        buffer.clear();
+        ws.async_read(buffer, [self = shared_from_this()](beast::error_code const& error, size_t)
+        {
+            if (error)
+            {
+                self->open = false;
+                return;
+            }
+            self->subscribe(beast::buffers_to_string(self->buffer.data()));
+            self->receive();
+        });
+    }
+
+    void subscribe(std::string const& message)
+    {
+        if (!device)
+        {
+            return;
+        }
+
+        std::string parse_error;
+        auto const jsn = json11::Json::parse(message, parse_error);
+        if (!parse_error.empty() || !jsn["subscribe"].is_array())
+        {
+            send(json11::Json(json11::Json::object { { "error", "expected {\"subscribe\": [keys]}" } }).dump());
+            return;
+        }
+
+        auto const& profile = device->profile;
+        WatchState next;
+        for (auto const& item : jsn["subscribe"].array_items())
+        {
+            auto const key = item.string_value();
+            auto const id = key == "start" ? profile.start_watch : key == "end" ? profile.end_watch : profile.find(key);
+            if (!id)
+            {
+                send(json11::Json(json11::Json::object { { "error", "unknown watch " + item.dump() } }).dump());
+                return;
+            }
+            next.set(*id);
+        }
+
+        // Frames of the old set already queued still go out before the
+        // reply, clients tell them apart by key.
+        subscribed = next;
+        auto const snapshot = device->sampler.latest();
+        send(subscription_to_frame(profile, subscribed, snapshot ? &snapshot->state : nullptr,
+                                   snapshot ? snapshot->age() : std::chrono::milliseconds(0)));
+    }
+
+    void send(std::string frame)
+    {
+        if (!open)
+        {
+            return;
+        }
+        if (queue.size() >= max_queued)
+        {
+            // Not reading; the pending write fails and clears the queue.
+            LOG_WARNING << "WebSocket: Client fell " << max_queued << " frames behind, closing";
+            open = false;
+            beast::error_code ignored;
+            beast::get_lowest_layer(ws).socket().close(ignored);
+            return;
+        }
+
+        queue.push_back(std::move(frame));
+        if (queue.size() == 1)
+        {
+            write_next();
+        }
+    }
+
+    void write_next()
+    {
+        ws.text(true);
+        ws.async_write(asio::buffer(queue.front()), [self = shared_from_this()](beast::error_code const& error, size_t)
+        {
+            if (error)
+            {
+                self->open = false;
+                self->queue.clear();
+                return;
+            }
+            self->queue.pop_front();
+            if (!self->queue.empty())
+            {
+                self->write_next();
+            }
+        });
+    }
+
+    websocket::stream<beast::tcp_stream> ws;
+    Devices const& devices;
+    beast::flat_buffer buffer;
+    http::request<http::string_body> request;
+    Device const* device = nullptr;
+    WatchState subscribed;
+    std::deque<std::string> queue;
+    bool open = false;
+};
+
+}
+
+class SubscriptionServer::Listener
+{
+public:
+    Listener(Devices const& devices, std::string const& address, int port)
+        : devices { devices }
+        , acceptor { io, { asio::ip::make_address(address), static_cast<unsigned short>(port) } }
+    {
+        accept();
+        thread = std::thread([this]
+        {
+            SpanTracer::instance().name_thread("websocket");
+            io.run();
+        });
+        for (auto const& device : devices)
+        {
+            pumps.emplace_back([this, &device = *device] { pump(device); });
+        }
+    }
+
+    ~Listener()
+    {
+        running = false;
+        for (auto & pump : pumps)
+        {
+            pump.join();
+        }
+        io.stop();
+        thread.join();
+    }
+
+private:
+    void accept()
+    {
+        acceptor.async_accept([this](beast::error_code const& error, tcp::socket socket)
+        {
+            if (!error)
+            {
+                auto session = std::make_shared<Session>(std::move(socket), devices);
+                session->start();
+                sessions.erase(std::remove_if(sessions.begin(), sessions.end(), [](auto const& s) { return s.expired(); }), sessions.end());
+                sessions.push_back(session);
+            }
+            accept();
+        });
+    }
+
+    // Hands the device's new events to the I/O thread as they are logged.
+    void pump(Device const& device)
+    {
+        auto cursor = device.events.last_sequence();
+        while (running)
+        {
+            auto events = device.events.wait_since(cursor, std::chrono::milliseconds(500));
+            if (events.empty())
+            {
+                continue;
+            }
+
+            cursor = events.back().sequence;
+            asio::post(io, [this, &device, events = std::move(events)]
+            {
+                for (auto const& session : sessions)
+                {
+                    if (auto const live = session.lock())
+                    {
+                        live->deliver(device, events);
+                    }
+                }
+            });
+        }
+    }
+
+    Devices const& devices;
+    asio::io_context io;
+    tcp::acceptor acceptor;
+    std::vector<std::weak_ptr<Session>> sessions;
+    std::atomic<bool> running { true };
+    std::vector<std::thread> pumps;
+    std::thread thread;
+};
+
+SubscriptionServer::SubscriptionServer(Devices const& devices, std::string const& address, int port)
+    : listener { std::make_unique<Listener>(devices, address, port) }
+{
+    LOG_INFO << "Serving subscriptions on ws://" << address << ':' << port;
+}
+
+SubscriptionServer::~SubscriptionServer() = default;
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "device.hpp"
+
+/**
+ * WebSocket endpoint pushing watch transitions as they are sampled.
+ *
+ * A client connects to / for the first device or /devices/<name>, then
+ * sends {"subscribe": ["<key>", ...]} whenever it wants a different set of
+ * watches; "start" and "end" stand for the profile's start and end watch.
+ * Each subscription is answered with the current values of its watches
+ * (subscription_to_frame), after that every transition of a subscribed
+ * watch arrives as one text frame (event_to_frame). Bad requests are
+ * answered with {"error": "..."}.
+ *
+ * Sessions live on one I/O thread. Each device has a thread blocked on its
+ * event log that hands new events to that thread, so an event is one post
+ * and one socket write away from the client. A client that stops reading
+ * is closed once it is 1024 frames behind.
+ */
+class SubscriptionServer
+{
+public:
+    SubscriptionServer(Devices const& devices, std::string const& address, int port);
+    ~SubscriptionServer();
+
+    SubscriptionServer(SubscriptionServer const&) = delete;
+    SubscriptionServer & operator=(SubscriptionServer const&) = delete;
+
+private:
+    class Listener;
+
+    std::unique_ptr<Listener> listener;
+};
@@ -1,4 +1,5 @@
-#include <iostream>
+#include <algorithm>
+#include <array>
 #include <stdexcept>
 #include <memory>
 #include <vector>
@@ -8,22 +9,21 @@
 
 #include <libserialport.h>
 
-#include <boost/algorithm/hex.hpp>
 #include <boost/endian/conversion.hpp>
 
 #include "json11.hpp"
+#include "logger.hpp"
+#include "span_trace.hpp"
+#include "super_metroid.hpp"
+#include "usba_framer.hpp"
 
-auto print_hex()
+void close_port(sp_port * port)
 {
-    return [](auto const& hex)
-    {
-        std::string s;
-        boost::algorithm::hex(std::begin(hex), std::end(hex), std::back_inserter(s));
-        std::cout << s << '\n';
-    };
+    sp_close(port);
+    sp_free_port(port);
 }
 
-std::unique_ptr<sp_port, decltype(&sp_close)> open_port(std::string const& name)
+SerialPort open_port(std::string const& name)
 {
     sp_port * port = nullptr;
     auto err = sp_get_port_by_name(name.c_str(), &port);
@@ -35,12 +35,13 @@ std::unique_ptr<sp_port, decltype(&sp_close)> open_port(std::string const& name)
     err = sp_open(port, SP_MODE_READ_WRITE);
     if (err != SP_OK)
     {
+        sp_free_port(port);
         std::ostringstream os;
         os << "Failed opening port: " << err << '\n';
         throw std::runtime_error(os.str());
     }
     static int counter = 0;
-    std::cout << "Opened port: " << counter << " number of times\n";
+    LOG_INFO << "Opened port: " << counter << " number of times";
     ++counter;
     sp_set_baudrate(port, 9600);
     sp_set_parity(port, SP_PARITY_NONE);
@@ -49,14 +50,7 @@ std::unique_ptr<sp_port, decltype(&sp_close)> open_port(std::string const& name)
     sp_set_dtr(port, SP_DTR_ON);
     // sp_set_dsr(port, SP_DSR_FLOW_CONTROL);
 
-    return std::unique_ptr<sp_port, decltype(&sp_close)>(port, sp_close);
-}
-
-uint32_t read_from_port(sp_port * port, uint32_t bytes, unsigned char * out_buffer)
-{
-    uint32_t total_read = sp_blocking_read(port, out_buffer, bytes, 4000);
-    std::cout << "Read: " << total_read << "/" << bytes << '\n';
-    return total_read;
+    return SerialPort(port, close_port);
 }
 
 template<typename OIter>
@@ -81,124 +75,159 @@ std::array<unsigned char, 512> create_read_sram_request(uint32_t address, uint32
     return full_buffer;
 }
 
-std::vector<unsigned char> read_sram(sp_port * port, uint32_t address, uint32_t bytes)
+std::array<unsigned char, 64> create_vget_request(SramRegion const* first, SramRegion const* last)
 {
-    auto const request = create_read_sram_request(address, bytes);
-
-    std::cout << "Serial: Writing request\n";
-    auto const result = sp_blocking_write(port, request.data(), request.size(), 4000);
-    if (result != request.size())
-    {
-        std::cerr << "Error: " << result << '\n';
-        throw std::runtime_error("Failed writing");
-    }
+    std::array<unsigned char, 64> full_buffer {{}};
+    // VGET, SNES space, 64 byte blocks and no response header.
+    static constexpr char header[] = "USBA\x02\x01\xc0";
 
-    std::cout << "Serial: Reading response\n";
-    unsigned char recv_buffer[512] {};
-    auto const read = read_from_port(port, sizeof(recv_buffer), recv_buffer);
-    if (read != sizeof(recv_buffer))
+    std::copy(std::begin(header), std::end(header), full_buffer.begin());
+    auto entry = full_buffer.begin() + 32;
+    for (; first != last; ++first)
     {
-        throw std::runtime_error("Failed reading");
+        *entry++ = static_cast<unsigned char>(first->size);
+        *entry++ = static_cast<unsigned char>(first->address >> 16);
+        *entry++ = static_cast<unsigned char>(first->address >> 8);
+        *entry++ = static_cast<unsigned char>(first->address);
     }
 
-    uint32_t to_read {};
-    std::copy(&recv_buffer[252], &recv_buffer[252]+sizeof(to_read), reinterpret_cast<char*>(&to_read));
-    to_read = boost::endian::big_to_native(to_read);
-
-    std::cout << "SRAM to read: " << to_read << '\n';
-    if (to_read != bytes)
-    {
-        throw std::runtime_error("Failed to read size");
-    }
+    return full_buffer;
+}
 
-    std::vector<unsigned char> sram_buffer(to_read);
-    if (read_from_port(port, to_read, sram_buffer.data()) != to_read)
+void write_to_port(sp_port * port, unsigned char const* data, size_t size, std::chrono::milliseconds timeout)
+{
+    Span span("serial.write");
+    LOG_DEBUG << "Serial: Writing request";
+    LOG_HEX_DUMP("Serial: Request", data, size);
+    // A timeout of 0 would block for good.
+    auto const result = sp_blocking_write(port, data, size, static_cast<unsigned int>(std::max<long>(1, timeout.count())));
+    if (result < 0 || static_cast<size_t>(result) != size)
     {
-        throw std::runtime_error("Failed reading sram");
+        LOG_ERROR << "Serial: Write returned " << static_cast<int>(result);
+        throw std::runtime_error("Failed writing");
     }
-
-    std::cout << "Read SRAM\n";
-    
-    return sram_buffer;
 }
 
-struct SuperMetroid
-{
-    std::string name;
-    unsigned int byte_offset;
-    unsigned char mask;
-};
+SerialMetrics::SerialMetrics(std::string const& port)
+    : round_trip { MetricsRegistry::instance().histogram("serial_round_trip_milliseconds", "Time from writing a request to its last response byte",
+                                                         exponential_buckets(1, 2, 12), { { "port", port } }) }
+    , reconnects { MetricsRegistry::instance().counter("serial_reconnects_total", "Serial port opens after the first", { { "port", port } }) }
+    , timeouts { MetricsRegistry::instance().counter("serial_timeouts_total", "Serial exchanges that missed their deadline", { { "port", port } }) }
+    , framing_errors { MetricsRegistry::instance().counter("serial_framing_errors_total", "Corrupt or stale responses skipped by the framer",
+                                                           { { "port", port } }) }
+{}
 
-static std::map<std::string, SuperMetroid> super_metroid
+std::vector<unsigned char> read_sram(sp_port * port, uint32_t address, uint32_t bytes)
 {
-     {"morph_ball"   , {"Morphing Ball", 0xB3, 0x04}}
-    ,{"bombs"        , {"Bomb",          0xB0, 0x80}}
-    ,{"spring_ball"  , {"Spring Ball", 0xC2, 0x40}}
-    ,{"high_jump"    , {"High Jump", 0xB6, 0x20}}
-    ,{"varia_suite"  , {"Varia Suite", 0xB6, 0x01}}
-    ,{"gravity_suite", {"Gravity Suite", 0xC0, 0x80}}
-    ,{"speed_booster", {"Speed Booster", 0xB8, 0x04}}
-    ,{"space_jump"   , {"Space Jump", 0xC3, 0x04}}
-    ,{"screw"        , {"Screw Attack", 0xB9, 0x80}}
-    ,{"charge"       , {"Charge", 0xB2, 0x80}}
-    ,{"ice"          , {"Ice Beam", 0xB6, 0x04}}
-    ,{"wave"         , {"Wave Beam", 0xB8, 0x10}}
-    ,{"spacer"       , {"Spacer Beam", 0xB5, 0x04}}
-    ,{"plasma"       , {"Plasma Beam", 0xC1, 0x80}}
-    ,{"grappling"    , {"Grappling Hook", 0xB7, 0x10}}
-    ,{"x-ray"        , {"X-Ray", 0xB4, 0x40}}
-    ,{"kraid"        , {"Kraid", 0x69, 0x01}}
-    ,{"phantoon"     , {"Phantoon", 0x6B, 0x01}}
-    ,{"botwoon"      , {"Botwoon", 0x6C, 0x02}}
-    ,{"draygon"      , {"Draygoon", 0x6C, 0x01}}
-    ,{"ridley"       , {"Ridley", 0x6A, 0x01}}
-    ,{"pb_red_tower" , {"Power Bombs (Red Tower)", 0xB5, 0x01}}
-    ,{"golden"       , {"Golden", 0x61, 0x04}}
-    ,{"mb1"          , {"Mother Brain 1", 0x60, 0x04}}
-    ,{"mb3"          , {"Mother Brain 3", 0x6D, 0x02}}
-    ,{"ship"         , {"Ship", 0xB5, 0x01}}
-};
-
-static constexpr uint32_t base_address = 0xf50000;
-
-std::map<std::string, bool> get_sm_state(sp_port * serial_port)
+    return read_sram_multi(port, { SramRegion { address, bytes } }, false).front();
+}
+
+UsbaRequest create_read_request(std::vector<SramRegion> const& regions, bool vector_read)
 {
-    static constexpr uint32_t base_items_address = base_address + 0xd7c0;
-    auto const sram = read_sram(serial_port, 0xf5d7c0, 512);
-    using namespace std::chrono_literals;
+    static constexpr size_t vget_max_regions = 8;
+    static constexpr uint32_t vget_max_size = 255;
 
-    std::cout << "SRAM: \n";
-    print_hex()(sram);
-    auto m = [](auto const& sram)
+    UsbaRequest request;
+    std::vector<SramRegion> batch;
+    UsbaExchange vget { {}, true };
+    auto flush_vget = [&]()
     {
-        std::map<std::string, bool> state;
-        for (auto & [key,value] : super_metroid)
+        if (batch.empty())
         {
-            state[key] = sram[value.byte_offset] & value.mask;
+            return;
         }
+        auto const frame = create_vget_request(batch.data(), batch.data() + batch.size());
+        request.frames.insert(request.frames.end(), frame.begin(), frame.end());
+        request.exchanges.push_back(std::move(vget));
+        vget = UsbaExchange { {}, true };
+        batch.clear();
+    };
 
-        return state;
-    }(sram);
+    for (size_t i = 0; i < regions.size(); ++i)
+    {
+        auto const& region = regions[i];
+        if (vector_read && region.size > 0 && region.size <= vget_max_size)
+        {
+            batch.push_back(region);
+            vget.regions.push_back(i);
+            if (batch.size() == vget_max_regions)
+            {
+                flush_vget();
+            }
+        }
+        else
+        {
+            auto const frame = create_read_sram_request(region.address, region.size);
+            request.frames.insert(request.frames.end(), frame.begin(), frame.end());
+            request.exchanges.push_back(UsbaExchange { {i}, false });
+        }
+    }
+    flush_vget();
 
-    return m;
+    return request;
 }
 
-bool game_started(sp_port * serial_port)
+std::vector<std::vector<unsigned char>> read_sram_multi(sp_port * port, std::vector<SramRegion> const& regions, bool vector_read,
+                                                        std::chrono::milliseconds timeout, SerialMetrics * metrics)
 {
-    static constexpr uint32_t autostart_address = base_address + 0x0998;
-    auto const autostart = read_sram(serial_port, autostart_address, 64);
-    std::cout << "SRAM: \n";
-    print_hex()(autostart);
+    auto const deadline = std::chrono::steady_clock::now() + timeout;
+    auto const request = create_read_request(regions, vector_read);
 
-    return autostart.size() && autostart[0] == 0x1f;
-}
+    // Every frame goes out before the first response is read, so the device
+    // never waits for the host between requests.
+    write_to_port(port, request.frames.data(), request.frames.size(), timeout);
 
-bool entered_ship(sp_port * serial_port)
-{
-    static constexpr uint32_t done_address = base_address + 0xfb2;
-    auto const done = read_sram(serial_port, done_address, 64);
-    std::cout << "SRAM: \n";
-    print_hex()(done);
+    // Room for all responses at once, headers and padding included.
+    size_t capacity = request.exchanges.size() * (512 + 64);
+    for (auto const& region : regions)
+    {
+        capacity += region.size;
+    }
+    UsbaFramer framer(capacity);
+
+    Span span("serial.read");
+    std::vector<std::vector<unsigned char>> result(regions.size());
+    for (auto const& exchange : request.exchanges)
+    {
+        while (true)
+        {
+            auto const status = framer.take(exchange, regions, result);
+            if (status == UsbaFramer::Status::complete)
+            {
+                break;
+            }
+            if (status == UsbaFramer::Status::skipped)
+            {
+                LOG_WARNING << "Serial: Skipped corrupt or stale bytes";
+                if (metrics)
+                {
+                    metrics->framing_errors.add();
+                }
+                continue;
+            }
+
+            // Rounded up, so a read only counts as timed out once its deadline passed.
+            auto const left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0)
+            {
+                if (metrics)
+                {
+                    metrics->timeouts.add();
+                }
+                throw std::runtime_error(exchange.vector ? "Failed reading vectored sram" : "Failed reading sram");
+            }
+
+            // Take whatever has arrived, the framer puts partial reads together.
+            auto const space = framer.write_space();
+            auto const read = sp_blocking_read_next(port, space.first, space.second, static_cast<unsigned int>(left));
+            if (read < 0)
+            {
+                throw std::runtime_error("Failed reading");
+            }
+            LOG_HEX_DUMP("Serial: Received", space.first, static_cast<size_t>(read));
+            framer.commit(static_cast<size_t>(read));
+        }
+    }
 
-    return done.size() >= 2 && done[0] == 0x4f && done[1] == 0xaa;
+    return result;
 }
@@ -1,14 +1,80 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <string>
-#include <map>
+#include <tuple>
+#include <vector>
 
 #include <libserialport.h>
 
-using SerialPort = std::unique_ptr<sp_port, decltype(&sp_close)>;
+#include "metrics.hpp"
 
+using SerialPort = std::unique_ptr<sp_port, void(*)(sp_port *)>;
+
+void close_port(sp_port * port);
 SerialPort open_port(std::string const& name);
-std::map<std::string, bool> get_sm_state(sp_port * serial_port);
-bool game_started(sp_port * serial_port);
-bool entered_ship(sp_port * serial_port);
+
+struct SramRegion
+{
+    uint32_t address;
+    uint32_t size;
+
+    bool operator<(SramRegion const& other) const
+    {
+        return std::tie(address, size) < std::tie(other.address, other.size);
+    }
+
+    bool operator==(SramRegion const& other) const
+    {
+        return address == other.address && size == other.size;
+    }
+};
+
+std::vector<unsigned char> read_sram(sp_port * port, uint32_t address, uint32_t bytes);
+
+/**
+ * Regions answered by one response, in the order the frames are sent.
+ */
+struct UsbaExchange
+{
+    std::vector<size_t> regions;
+    bool vector;
+};
+
+struct UsbaRequest
+{
+    std::vector<unsigned char> frames;
+    std::vector<UsbaExchange> exchanges;
+};
+
+/**
+ * Frames reading several regions in one exchange with the device. Regions
+ * of at most 255 bytes are combined into VGET frames when vector_read is
+ * set; all other regions are sent as GET frames pipelined behind them.
+ */
+UsbaRequest create_read_request(std::vector<SramRegion> const& regions, bool vector_read);
+
+/**
+ * Instruments of one serial port, shared by both transports. Round trips
+ * are in milliseconds; reconnects count opens after the first.
+ */
+struct SerialMetrics
+{
+    explicit SerialMetrics(std::string const& port);
+
+    Histogram & round_trip;
+    Counter & reconnects;
+    Counter & timeouts;
+    Counter & framing_errors;
+};
+
+/**
+ * Read several regions in one exchange, see create_read_request. Throws if
+ * the whole exchange, write included, takes longer than timeout. Timeouts
+ * and skipped bytes are counted in metrics, if given.
+ */
+std::vector<std::vector<unsigned char>> read_sram_multi(sp_port * port, std::vector<SramRegion> const& regions, bool vector_read = true,
+                                                        std::chrono::milliseconds timeout = std::chrono::milliseconds(4000),
+                                                        SerialMetrics * metrics = nullptr);
@@ -0,0 +1,240 @@
+#include "trace_file.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+namespace
+{
+
+constexpr char trace_magic[] = "PLUTOTRC";
+constexpr char index_magic[] = "PLUTOIDX";
+constexpr size_t magic_size = sizeof(trace_magic) - 1;
+
+std::FILE * open_append(std::string const& path, char const* magic)
+{
+    auto file = std::fopen(path.c_str(), "ab");
+    if (!file)
+    {
+        throw std::runtime_error("Trace: could not open " + path);
+    }
+    if (std::ftell(file) == 0 && (std::fwrite(magic, 1, magic_size, file) != magic_size || std::fflush(file) != 0))
+    {
+        std::fclose(file);
+        throw std::runtime_error("Trace: could not write " + path);
+    }
+    return file;
+}
+
+// Time of the index's last sample, 0 for an empty one. An entry torn by a
+// crash is cut off, appending after it would misalign every later one.
+uint64_t last_time_us(std::string const& path)
+{
+    struct stat st {};
+    if (::stat(path.c_str(), &st) != 0 || static_cast<size_t>(st.st_size) < magic_size)
+    {
+        return 0;
+    }
+
+    auto const whole = (static_cast<size_t>(st.st_size) - magic_size) / sizeof(TraceIndexEntry);
+    auto const size = magic_size + whole * sizeof(TraceIndexEntry);
+    if (size != static_cast<size_t>(st.st_size) && ::truncate(path.c_str(), static_cast<off_t>(size)) != 0)
+    {
+        throw std::runtime_error("Trace: could not repair " + path);
+    }
+    if (!whole)
+    {
+        return 0;
+    }
+
+    TraceIndexEntry entry {};
+    auto file = std::fopen(path.c_str(), "rb");
+    bool const read = file && std::fseek(file, static_cast<long>(size - sizeof(entry)), SEEK_SET) == 0
+                      && std::fread(&entry, sizeof(entry), 1, file) == 1;
+    if (file)
+    {
+        std::fclose(file);
+    }
+    if (!read)
+    {
+        throw std::runtime_error("Trace: could not read " + path);
+    }
+    return entry.time_us;
+}
+
+}
+
+TraceRecorder::TraceRecorder(std::string const& path)
+    : trace { open_append(path, trace_magic) }
+    , index { open_append(path + ".idx", index_magic) }
+    , offset { static_cast<uint64_t>(std::ftell(trace)) }
+    , resume_us { last_time_us(path + ".idx") }
+{}
+
+TraceRecorder::~TraceRecorder()
+{
+    std::fclose(index);
+    std::fclose(trace);
+}
+
+void TraceRecorder::record(std::chrono::steady_clock::time_point timestamp,
+                           std::vector<SramRegion> const& regions,
+                           std::vector<std::vector<unsigned char>> const& data)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    if (failed)
+    {
+        return;
+    }
+    if (!start)
+    {
+        start = timestamp;
+    }
+
+    auto const time_us = resume_us + static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(timestamp - *start).count());
+    TraceIndexEntry const entry { time_us, offset, static_cast<uint32_t>(regions.size()), 0 };
+
+    bool written = true;
+    for (size_t i = 0; i < regions.size() && written; ++i)
+    {
+        TraceRecord const record { time_us, regions[i].address, static_cast<uint32_t>(data[i].size()) };
+        written = std::fwrite(&record, sizeof(record), 1, trace) == 1
+                  && std::fwrite(data[i].data(), 1, data[i].size(), trace) == data[i].size();
+        offset += sizeof(record) + data[i].size();
+    }
+
+    // The index entry goes last, so a reader never sees it before its records.
+    written = written && std::fflush(trace) == 0;
+    written = written && std::fwrite(&entry, sizeof(entry), 1, index) == 1 && std::fflush(index) == 0;
+    if (!written)
+    {
+        LOG_ERROR << "Trace: Write failed (" << std::strerror(errno) << "), recording stopped";
+        failed = true;
+    }
+}
+
+TraceReader::TraceReader(std::string const& path)
+    : trace { map(path, trace_magic) }
+    , index { map(path + ".idx", index_magic) }
+    , entries { reinterpret_cast<TraceIndexEntry const*>(index.data + magic_size) }
+    , entry_count { (index.size - magic_size) / sizeof(TraceIndexEntry) }
+{
+    if (!entry_count)
+    {
+        throw std::runtime_error("Trace: " + path + " has no samples");
+    }
+}
+
+TraceReader::~TraceReader()
+{
+    ::munmap(const_cast<unsigned char *>(trace.data), trace.size);
+    ::munmap(const_cast<unsigned char *>(index.data), index.size);
+}
+
+TraceReader::Mapping TraceReader::map(std::string const& path, char const* magic)
+{
+    auto const fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Trace: could not open " + path);
+    }
+
+    struct stat st {};
+    ::fstat(fd, &st);
+    auto const size = static_cast<size_t>(st.st_size);
+    void * data = size >= magic_size ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+
+    if (data == MAP_FAILED || std::memcmp(data, magic, magic_size) != 0)
+    {
+        if (data != MAP_FAILED)
+        {
+            ::munmap(data, size);
+        }
+        throw std::runtime_error("Trace: " + path + " is not a trace file");
+    }
+
+    return Mapping { static_cast<unsigned char const*>(data), size };
+}
+
+size_t TraceReader::samples() const
+{
+    return entry_count;
+}
+
+uint64_t TraceReader::duration_us() const
+{
+    return entries[entry_count - 1].time_us;
+}
+
+size_t TraceReader::seek(uint64_t time_us) const
+{
+    auto const it = std::upper_bound(entries, entries + entry_count, time_us,
+            [](uint64_t time_us, TraceIndexEntry const& entry) { return time_us < entry.time_us; });
+    return it == entries ? 0 : static_cast<size_t>(it - entries - 1);
+}
+
+std::vector<std::vector<unsigned char>> TraceReader::read(size_t sample, std::vector<SramRegion> const& regions) const
+{
+    std::vector<std::vector<unsigned char>> result;
+    for (auto const& region : regions)
+    {
+        result.emplace_back(region.size);
+    }
+
+    auto const& entry = entries[std::min(sample, entry_count - 1)];
+    auto offset = entry.offset;
+    for (uint32_t i = 0; i < entry.records && offset + sizeof(TraceRecord) <= trace.size; ++i)
+    {
+        TraceRecord record;
+        std::memcpy(&record, trace.data + offset, sizeof(record));
+        auto const bytes = trace.data + offset + sizeof(record);
+        offset += sizeof(record) + record.length;
+        if (offset > trace.size)
+        {
+            break;
+        }
+
+        // Copy the overlap of the recorded bytes with every requested region.
+        for (size_t r = 0; r < regions.size(); ++r)
+        {
+            auto const begin = std::max(regions[r].address, record.address);
+            auto const end = std::min(regions[r].address + regions[r].size, record.address + record.length);
+            if (begin < end)
+            {
+                std::copy(bytes + (begin - record.address), bytes + (end - record.address),
+                          result[r].begin() + (begin - regions[r].address));
+            }
+        }
+    }
+
+    return result;
+}
+
+TraceReplay::TraceReplay(std::string const& path, double speed)
+    : path { path }
+    , reader { path }
+    , speed { speed }
+    , start { std::chrono::steady_clock::now() }
+{
+    LOG_INFO << "Replaying " << reader.samples() << " samples (" << reader.duration_us() / 1000 << " ms) at " << speed << 'x';
+}
+
+RegionData TraceReplay::read(std::vector<SramRegion> const& regions)
+{
+    auto const elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() * speed;
+    return reader.read(reader.seek(static_cast<uint64_t>(elapsed_us)), regions);
+}
+
+std::string TraceReplay::describe() const
+{
+    return "replay:" + path;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "memory_source.hpp"
+#include "super_metroid.hpp"
+
+/**
+ * On-disk layout of a SRAM trace.
+ *
+ * <name>      "PLUTOTRC" magic, then records appended one after another:
+ *             TraceRecord header followed by length bytes of SRAM.
+ * <name>.idx  "PLUTOIDX" magic, then one TraceIndexEntry per sample,
+ *             sorted by time, pointing at the sample's first record.
+ *
+ * Both files are append-only and read back through mmap.
+ */
+struct TraceRecord
+{
+    uint64_t time_us;
+    uint32_t address;
+    uint32_t length;
+};
+
+struct TraceIndexEntry
+{
+    uint64_t time_us;
+    uint64_t offset;
+    uint32_t records;
+    uint32_t reserved;
+};
+
+/**
+ * Appends every sampled region to a trace. Times are relative to the first
+ * recorded sample; recording into an existing trace continues from its
+ * last sample, so the index stays sorted. A failed write stops the
+ * recording, the sample it was writing never reaches the index.
+ */
+class TraceRecorder
+{
+public:
+    explicit TraceRecorder(std::string const& path);
+    ~TraceRecorder();
+
+    TraceRecorder(TraceRecorder const&) = delete;
+    TraceRecorder & operator=(TraceRecorder const&) = delete;
+
+    void record(std::chrono::steady_clock::time_point timestamp,
+                std::vector<SramRegion> const& regions,
+                std::vector<std::vector<unsigned char>> const& data);
+
+private:
+    std::mutex mutex;
+    std::FILE * trace = nullptr;
+    std::FILE * index = nullptr;
+    uint64_t offset = 0;
+    uint64_t resume_us = 0;
+    bool failed = false;
+    std::optional<std::chrono::steady_clock::time_point> start;
+};
+
+/**
+ * Read-only view of a recorded trace.
+ */
+class TraceReader
+{
+public:
+    explicit TraceReader(std::string const& path);
+    ~TraceReader();
+
+    TraceReader(TraceReader const&) = delete;
+    TraceReader & operator=(TraceReader const&) = delete;
+
+    size_t samples() const;
+    uint64_t duration_us() const;
+
+    /**
+     * Index of the last sample taken at or before time_us, binary search over the index.
+     */
+    size_t seek(uint64_t time_us) const;
+
+    /**
+     * Bytes of sample for each region, zero where the sample does not cover it.
+     */
+    std::vector<std::vector<unsigned char>> read(size_t sample, std::vector<SramRegion> const& regions) const;
+
+private:
+    struct Mapping
+    {
+        unsigned char const* data = nullptr;
+        size_t size = 0;
+    };
+
+    static Mapping map(std::string const& path, char const* magic);
+
+    Mapping trace;
+    Mapping index;
+    TraceIndexEntry const* entries = nullptr;
+    size_t entry_count = 0;
+};
+
+/**
+ * Plays a trace back in place of the device. Time starts when the replay is
+ * created and runs speed times faster than real time; after the end the
+ * last sample is returned.
+ */
+class TraceReplay : public MemorySource
+{
+public:
+    TraceReplay(std::string const& path, double speed);
+
+    RegionData read(std::vector<SramRegion> const& regions) override;
+    std::string describe() const override;
+
+private:
+    std::string const path;
+    TraceReader reader;
+    double const speed;
+    std::chrono::steady_clock::time_point const start;
+};
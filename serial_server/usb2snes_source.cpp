@@ -0,0 +1,209 @@
+#include "usb2snes_source.hpp"
+
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+
+#include "json11.hpp"
+#include "logger.hpp"
+
+namespace beast = boost::beast;
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+
+namespace
+{
+
+// sd2snes firmware serves at most 8 ranges per vector read, servers split
+// larger requests into several device commands.
+constexpr size_t ranges_per_request = 8;
+
+std::string hex(uint32_t value)
+{
+    char buffer[16];
+    std::snprintf(buffer, sizeof(buffer), "%X", value);
+    return buffer;
+}
+
+}
+
+struct Usb2SnesSource::Connection
+{
+    asio::io_context io;
+    beast::websocket::stream<beast::tcp_stream> ws { io };
+    beast::flat_buffer buffer;
+
+    // Runs one async operation to completion, or fails it at the timeout.
+    template <typename Start>
+    void run(std::chrono::milliseconds timeout, char const* what, Start && start)
+    {
+        beast::error_code error;
+        beast::get_lowest_layer(ws).expires_after(timeout);
+        start([&error](beast::error_code e, auto &&...) { error = e; });
+        io.restart();
+        io.run();
+        if (error)
+        {
+            throw std::runtime_error(std::string("usb2snes: ") + what + ": " + error.message());
+        }
+    }
+
+    void send(json11::Json const& request, std::chrono::milliseconds timeout)
+    {
+        auto const text = request.dump();
+        ws.text(true);
+        run(timeout, "write", [this, &text](auto handler) { ws.async_write(asio::buffer(text), handler); });
+    }
+
+    void receive(std::chrono::milliseconds timeout)
+    {
+        buffer.clear();
+        run(timeout, "read", [this](auto handler) { ws.async_read(buffer, handler); });
+    }
+};
+
+Usb2SnesSource::Usb2SnesSource(std::string host, std::string port, std::string device, std::chrono::milliseconds timeout)
+    : host { std::move(host) }
+    , port { std::move(port) }
+    , device { std::move(device) }
+    , timeout { timeout }
+{}
+
+Usb2SnesSource::~Usb2SnesSource() = default;
+
+std::string Usb2SnesSource::describe() const
+{
+    return "usb2snes:" + host + ":" + port + (device.empty() ? "" : "/" + device);
+}
+
+void Usb2SnesSource::connect()
+{
+    auto next = std::make_unique<Connection>();
+    auto & ws = next->ws;
+
+    tcp::resolver resolver(next->io);
+    auto const endpoints = resolver.resolve(host, port);
+    next->run(timeout, "connect", [&ws, &endpoints](auto handler) { beast::get_lowest_layer(ws).async_connect(endpoints, handler); });
+    next->run(timeout, "handshake", [&ws, this](auto handler) { ws.async_handshake(host + ":" + port, "/", handler); });
+
+    auto attach = device;
+    if (attach.empty())
+    {
+        next->send(json11::Json::object { { "Opcode", "DeviceList" }, { "Space", "SNES" } }, timeout);
+        next->receive(timeout);
+
+        std::string parse_error;
+        auto const reply = json11::Json::parse(beast::buffers_to_string(next->buffer.data()), parse_error);
+        if (reply["Results"].array_items().empty())
+        {
+            throw std::runtime_error("usb2snes: no devices on " + host + ":" + port);
+        }
+        attach = reply["Results"][0].string_value();
+    }
+
+    next->send(json11::Json::object { { "Opcode", "Attach" }, { "Space", "SNES" }, { "Operands", json11::Json::array { attach } } }, timeout);
+    next->send(json11::Json::object { { "Opcode", "Name" }, { "Space", "SNES" }, { "Operands", json11::Json::array { "pluto" } } }, timeout);
+    connection = std::move(next);
+    LOG_INFO << "usb2snes: Attached to " << attach << " on " << host << ':' << port;
+}
+
+RegionData Usb2SnesSource::read(std::vector<SramRegion> const& regions)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+
+    try
+    {
+        if (!connection)
+        {
+            connect();
+        }
+
+        size_t total = 0;
+        for (size_t first = 0; first < regions.size(); first += ranges_per_request)
+        {
+            json11::Json::array operands;
+            for (size_t i = first; i < regions.size() && i < first + ranges_per_request; ++i)
+            {
+                operands.push_back(hex(regions[i].address));
+                operands.push_back(hex(regions[i].size));
+                total += regions[i].size;
+            }
+            connection->send(json11::Json::object { { "Opcode", "GetAddress" }, { "Space", "SNES" }, { "Operands", operands } }, timeout);
+        }
+
+        std::string bytes;
+        bytes.reserve(total);
+        while (bytes.size() < total)
+        {
+            connection->receive(timeout);
+            if (connection->ws.got_text())
+            {
+                throw std::runtime_error("usb2snes: unexpected text reply");
+            }
+            bytes += beast::buffers_to_string(connection->buffer.data());
+        }
+        if (bytes.size() != total)
+        {
+            throw std::runtime_error("usb2snes: reply longer than requested");
+        }
+
+        RegionData result;
+        result.reserve(regions.size());
+        size_t offset = 0;
+        for (auto const& region : regions)
+        {
+            result.emplace_back(bytes.begin() + offset, bytes.begin() + offset + region.size);
+            offset += region.size;
+        }
+        return result;
+    }
+    catch (std::exception const&)
+    {
+        // The reply stream is out of step with the requests, start over.
+        connection.reset();
+        throw;
+    }
+}
+
+std::unique_ptr<MemorySource> make_usb2snes_source(std::string const& target)
+{
+    auto const question = target.find('?');
+    auto const address = target.substr(0, question);
+
+    auto const colon = address.rfind(':');
+    auto const host = address.empty() ? std::string("localhost") : address.substr(0, colon);
+    auto const port = colon == std::string::npos ? std::string("23074") : address.substr(colon + 1);
+
+    std::string device;
+    std::chrono::milliseconds timeout { 500 };
+    if (question != std::string::npos)
+    {
+        std::istringstream is(target.substr(question + 1));
+        std::string option;
+        while (std::getline(is, option, '&'))
+        {
+            auto const equals = option.find('=');
+            auto const key = option.substr(0, equals);
+            auto const value = equals == std::string::npos ? std::string() : option.substr(equals + 1);
+            if (key == "device")
+            {
+                device = value;
+            }
+            else if (key == "timeout")
+            {
+                timeout = std::chrono::milliseconds(std::stoul(value));
+            }
+            else
+            {
+                throw SourceConfigError("Unknown usb2snes source option " + option);
+            }
+        }
+    }
+
+    return std::make_unique<Usb2SnesSource>(host, port, device, timeout);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "memory_source.hpp"
+
+/**
+ * Reads memory through a usb2snes compatible WebSocket server (QUsb2Snes,
+ * SNI, ...), for when that server already holds the device.
+ *
+ * Regions are batched into multi-range GetAddress requests, and all
+ * requests of a read are written before the first reply is awaited. The
+ * server answers in request order with binary messages that may be split
+ * at any byte, so replies are treated as one stream and sliced by size.
+ * The connection is opened by the first read, so the server may start
+ * later, kept open between reads and reopened after an error. Without a
+ * device name the first device listed is attached on every connect.
+ */
+class Usb2SnesSource : public MemorySource
+{
+public:
+    Usb2SnesSource(std::string host, std::string port, std::string device, std::chrono::milliseconds timeout);
+    ~Usb2SnesSource();
+
+    RegionData read(std::vector<SramRegion> const& regions) override;
+    std::string describe() const override;
+
+private:
+    struct Connection;
+
+    void connect();
+
+    std::string const host;
+    std::string const port;
+    std::string const device;
+    std::chrono::milliseconds const timeout;
+
+    std::mutex mutex;
+    std::unique_ptr<Connection> connection;
+};
+
+/**
+ * Parse "<host>[:port][?device=name&timeout=ms]" (without the scheme).
+ */
+std::unique_ptr<MemorySource> make_usb2snes_source(std::string const& target);
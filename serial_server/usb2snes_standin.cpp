@@ -0,0 +1,163 @@
+// Stand-in for a usb2snes WebSocket server (QUsb2Snes, SNI). Serves one
+// device backed by a 128 KiB WRAM image, so the usb2snes: memory source
+// can be used without a console:
+//
+//   usb2snes_standin [--port 23074] [--script file] [--chunk bytes]
+//
+// GetAddress replies are sent as binary messages of at most --chunk bytes,
+// like real servers split them. The script format is described in
+// memory_script.hpp, addresses are in the usb2snes space (WRAM at 0xf50000).
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+
+#include "json11.hpp"
+#include "memory_script.hpp"
+
+namespace beast = boost::beast;
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+
+namespace
+{
+
+constexpr uint32_t wram_address = 0xf50000;
+constexpr char const* device_name = "PLUTO STAND-IN";
+
+struct Memory
+{
+    std::mutex mutex;
+    std::vector<unsigned char> wram = std::vector<unsigned char>(0x20000);
+
+    std::string read(uint32_t address, uint32_t size)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        std::string bytes(size, '\0');
+        for (uint32_t i = 0; i < size; ++i)
+        {
+            auto const offset = address + i - wram_address;
+            if (address + i >= wram_address && offset < wram.size())
+            {
+                bytes[i] = static_cast<char>(wram[offset]);
+            }
+        }
+        return bytes;
+    }
+};
+
+void serve(tcp::socket socket, Memory & memory, size_t chunk)
+{
+    try
+    {
+        beast::websocket::stream<tcp::socket> ws(std::move(socket));
+        ws.accept();
+        std::cout << "Client connected" << std::endl;
+
+        while (true)
+        {
+            beast::flat_buffer buffer;
+            ws.read(buffer);
+
+            std::string error;
+            auto const request = json11::Json::parse(beast::buffers_to_string(buffer.data()), error);
+            auto const opcode = request["Opcode"].string_value();
+            auto const& operands = request["Operands"].array_items();
+
+            if (opcode == "DeviceList" || opcode == "Info")
+            {
+                json11::Json::array results { device_name };
+                if (opcode == "Info")
+                {
+                    results = { "1.0", "STAND-IN", "No Info" };
+                }
+                ws.text(true);
+                ws.write(asio::buffer(json11::Json(json11::Json::object { { "Results", results } }).dump()));
+            }
+            else if (opcode == "GetAddress")
+            {
+                std::string reply;
+                for (size_t i = 0; i + 1 < operands.size(); i += 2)
+                {
+                    auto const address = std::stoul(operands[i].string_value(), nullptr, 16);
+                    auto const size = std::stoul(operands[i + 1].string_value(), nullptr, 16);
+                    reply += memory.read(address, size);
+                }
+
+                ws.binary(true);
+                for (size_t offset = 0; offset < reply.size(); offset += chunk)
+                {
+                    ws.write(asio::buffer(reply.data() + offset, std::min(chunk, reply.size() - offset)));
+                }
+            }
+            else if (opcode != "Attach" && opcode != "Name")
+            {
+                std::cout << "Unsupported opcode " << opcode << std::endl;
+            }
+        }
+    }
+    catch (std::exception const& e)
+    {
+        std::cout << "Client gone: " << e.what() << std::endl;
+    }
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    unsigned short port = 23074;
+    std::string script;
+    size_t chunk = 1024;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string const key = argv[i];
+        if (key == "--port")
+        {
+            port = static_cast<unsigned short>(std::stoul(argv[i + 1]));
+        }
+        else if (key == "--script")
+        {
+            script = argv[i + 1];
+        }
+        else if (key == "--chunk")
+        {
+            chunk = std::max<size_t>(1, std::stoul(argv[i + 1]));
+        }
+    }
+
+    Memory memory;
+    std::thread([&memory, steps = load_script(script)]() mutable
+    {
+        ScriptPlayer player(std::move(steps));
+        while (player.next_timeout_ms() >= 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(player.next_timeout_ms()));
+            std::lock_guard<std::mutex> guard(memory.mutex);
+            player.apply_due([&memory](uint32_t address, std::vector<unsigned char> const& bytes)
+            {
+                for (size_t i = 0; i < bytes.size() && address - wram_address + i < memory.wram.size(); ++i)
+                {
+                    memory.wram[address - wram_address + i] = bytes[i];
+                }
+                std::cout << "Script: " << std::hex << address << std::dec << std::endl;
+            });
+        }
+    }).detach();
+
+    asio::io_context io;
+    tcp::acceptor acceptor(io, { asio::ip::make_address("127.0.0.1"), port });
+    std::cout << "usb2snes stand-in on ws://127.0.0.1:" << port << std::endl;
+    while (true)
+    {
+        std::thread(serve, acceptor.accept(), std::ref(memory), chunk).detach();
+    }
+}
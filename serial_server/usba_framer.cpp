@@ -0,0 +1,155 @@
+#include "usba_framer.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+
+constexpr size_t header_size = 512;
+constexpr unsigned char op_response = 15;
+constexpr unsigned char magic[] = { 'U', 'S', 'B', 'A' };
+
+// Data is sent in 64 byte blocks, the tail of the last block is padding.
+size_t padded(size_t bytes)
+{
+    return (bytes + 63) / 64 * 64;
+}
+
+size_t round_up_to_power_of_two(size_t value)
+{
+    size_t result = 1;
+    while (result < value)
+    {
+        result <<= 1;
+    }
+    return result;
+}
+
+}
+
+UsbaFramer::UsbaFramer(size_t capacity)
+    : buffer(round_up_to_power_of_two(capacity))
+    , mask { buffer.size() - 1 }
+{}
+
+std::pair<unsigned char *, size_t> UsbaFramer::write_space()
+{
+    auto const free = buffer.size() - size();
+    if (free == 0)
+    {
+        throw std::runtime_error("Framer: buffer full");
+    }
+
+    auto const offset = tail & mask;
+    return { buffer.data() + offset, std::min(free, buffer.size() - offset) };
+}
+
+void UsbaFramer::commit(size_t size)
+{
+    tail += size;
+}
+
+void UsbaFramer::append(unsigned char const* data, size_t size)
+{
+    while (size > 0)
+    {
+        auto const space = write_space();
+        auto const n = std::min(size, space.second);
+        std::copy(data, data + n, space.first);
+        commit(n);
+        data += n;
+        size -= n;
+    }
+}
+
+UsbaFramer::Status UsbaFramer::take(UsbaExchange const& exchange, std::vector<SramRegion> const& regions,
+                                    std::vector<std::vector<unsigned char>> & result)
+{
+    size_t payload = 0;
+    for (auto const i : exchange.regions)
+    {
+        payload += regions[i].size;
+    }
+
+    size_t start = 0;
+    if (!exchange.vector)
+    {
+        // Resynchronise on the next header.
+        size_t found = 0;
+        while (found + sizeof(magic) <= size()
+               && !(at(found) == magic[0] && at(found + 1) == magic[1] && at(found + 2) == magic[2] && at(found + 3) == magic[3]))
+        {
+            ++found;
+        }
+        if (found > 0)
+        {
+            drop(found);
+            return Status::skipped;
+        }
+        if (size() < header_size)
+        {
+            return Status::incomplete;
+        }
+
+        auto const announced = number_at(252);
+        if (at(4) != op_response || announced != payload)
+        {
+            // A well formed frame, but not ours: a response left over from
+            // an aborted exchange. Drop it if it is plausible, else just the
+            // header so the search starts again behind it.
+            auto const frame = header_size + padded(announced);
+            drop(at(4) == op_response && frame <= size() ? frame : sizeof(magic));
+            return Status::skipped;
+        }
+        start = header_size;
+    }
+
+    if (size() < start + padded(payload))
+    {
+        return Status::incomplete;
+    }
+
+    auto offset = start;
+    for (auto const i : exchange.regions)
+    {
+        result[i].resize(regions[i].size);
+        copy(offset, regions[i].size, result[i].data());
+        offset += regions[i].size;
+    }
+    drop(start + padded(payload));
+    return Status::complete;
+}
+
+void UsbaFramer::clear()
+{
+    head = tail = 0;
+}
+
+size_t UsbaFramer::size() const
+{
+    return tail - head;
+}
+
+unsigned char UsbaFramer::at(size_t offset) const
+{
+    return buffer[(head + offset) & mask];
+}
+
+uint32_t UsbaFramer::number_at(size_t offset) const
+{
+    return uint32_t(at(offset)) << 24 | uint32_t(at(offset + 1)) << 16 | uint32_t(at(offset + 2)) << 8 | at(offset + 3);
+}
+
+void UsbaFramer::copy(size_t offset, size_t size, unsigned char * out) const
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        out[i] = at(offset + i);
+    }
+}
+
+void UsbaFramer::drop(size_t size)
+{
+    head += std::min(size, this->size());
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "super_metroid.hpp"
+
+/**
+ * Incremental parser for device responses.
+ *
+ * Bytes are appended as they arrive, in reads of any size, to a ring
+ * buffer, and take() cuts the response to an exchange off the front once
+ * it is complete. GET responses are checked against their header: bytes
+ * before the next "USBA" are skipped, and a header with the wrong opcode
+ * or size drops the whole frame it announces. VGET responses have no
+ * header and are only checked by length.
+ */
+class UsbaFramer
+{
+public:
+    enum class Status
+    {
+        incomplete,
+        complete,
+        skipped
+    };
+
+    explicit UsbaFramer(size_t capacity = 1 << 16);
+
+    /**
+     * Contiguous free space to read into, commit() what was read.
+     * Throws std::runtime_error when the buffer is full.
+     */
+    std::pair<unsigned char *, size_t> write_space();
+    void commit(size_t size);
+    void append(unsigned char const* data, size_t size);
+
+    /**
+     * skipped: corrupt or stale bytes were dropped from the front, call
+     * again. complete: the exchange's regions were written to result.
+     */
+    Status take(UsbaExchange const& exchange, std::vector<SramRegion> const& regions,
+                std::vector<std::vector<unsigned char>> & result);
+
+    void clear();
+    size_t size() const;
+
+private:
+    unsigned char at(size_t offset) const;
+    uint32_t number_at(size_t offset) const;
+    void copy(size_t offset, size_t size, unsigned char * out) const;
+    void drop(size_t size);
+
+    std::vector<unsigned char> buffer;
+    size_t const mask;
+    size_t head = 0;
+    size_t tail = 0;
+};